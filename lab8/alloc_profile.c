@@ -0,0 +1,152 @@
+#include "include/alloc_profile.h"
+#include "include/buddy_system.h"
+#include "include/exception.h"
+#include "include/meminfo.h"
+#include "include/slab.h"
+#include "include/types.h"
+#include "include/uart.h"
+#include "include/vmalloc.h"
+
+#ifdef ALLOC_PROFILE
+extern alloc_site_t alloc_sites[];
+extern frame_array_node_t frame_array[];
+
+// Open addressing on the return address; a full table falls back to site 0.
+static uint16_t alloc_profile_site(uint64_t caller) {
+  uint32_t start = 1 + (caller >> 2) % (ALLOC_PROFILE_SITES - 1);
+  uint32_t i = start;
+  do {
+    if (alloc_sites[i].caller == caller) {
+      return i;
+    }
+    if (alloc_sites[i].caller == 0) {
+      alloc_sites[i].caller = caller;
+      return i;
+    }
+    i = i + 1 < ALLOC_PROFILE_SITES ? i + 1 : 1;
+  } while (i != start);
+  return 0;
+}
+
+static alloc_profile_tag_t *alloc_profile_tag_of(kmem_cache_t *cache,
+                                                 void *object) {
+  return (alloc_profile_tag_t *)((char *)object + cache->object_size -
+                                 ALLOC_PROFILE_TAG_SIZE);
+}
+
+void alloc_profile_tag(void *ptr, uint32_t size, uint64_t caller) {
+  if (alloc_profile_depth || !ptr) {
+    return;
+  }
+  lock();
+  uint16_t site = alloc_profile_site(caller);
+  kmem_cache_t *cache = kmem_cache_of(ptr);
+  if (cache) {
+    alloc_profile_tag_t *tag = alloc_profile_tag_of(cache, ptr);
+    tag->size = size;
+    tag->site = site;
+    tag->valid = 1;
+  } else {
+    frame_array_node_t *frame =
+        &frame_array[((uint64_t)ptr - BUDDY_MEMORY_BASE) / PAGE_SIZE];
+    size = PAGE_SIZE << frame->order;
+    frame->flags |= FRAME_PROFILED;
+    frame->cache = site;
+  }
+  alloc_sites[site].live_bytes += size;
+  alloc_sites[site].live_count++;
+  alloc_sites[site].allocs++;
+  unlock();
+}
+
+void alloc_profile_untag(void *ptr) {
+  if (alloc_profile_depth || !ptr) {
+    return;
+  }
+  lock();
+  uint16_t site;
+  uint32_t size;
+  kmem_cache_t *cache = kmem_cache_of(ptr);
+  if (cache) {
+    alloc_profile_tag_t *tag = alloc_profile_tag_of(cache, ptr);
+    if (!tag->valid) {
+      unlock();
+      return;
+    }
+    site = tag->site;
+    size = tag->size;
+    tag->valid = 0;
+  } else {
+    if ((uint64_t)ptr < BUDDY_MEMORY_BASE ||
+        (uint64_t)ptr >= BUDDY_MEMORY_BASE + TOTAL_MEMORY) {
+      unlock();
+      return;
+    }
+    frame_array_node_t *frame =
+        &frame_array[((uint64_t)ptr - BUDDY_MEMORY_BASE) / PAGE_SIZE];
+    if (!(frame->flags & FRAME_PROFILED)) {
+      unlock();
+      return;
+    }
+    site = frame->cache;
+    size = PAGE_SIZE << frame->order;
+    frame->flags &= ~FRAME_PROFILED;
+  }
+  alloc_sites[site].live_bytes -= size;
+  alloc_sites[site].live_count--;
+  unlock();
+}
+
+// Sites with live memory, largest first. Addresses are printed raw so the
+// host can resolve them with addr2line.
+uint32_t alloc_profile_render(char *buf, uint32_t size) {
+  static uint8_t shown[ALLOC_PROFILE_SITES];
+  uint32_t len = 0;
+  lock();
+  for (uint32_t i = 0; i < ALLOC_PROFILE_SITES; ++i) {
+    shown[i] = 0;
+  }
+  len = meminfo_append(buf, size, len,
+                       "caller              live_bytes  live  allocs\n");
+  while (1) {
+    int best = -1;
+    for (uint32_t i = 0; i < ALLOC_PROFILE_SITES; ++i) {
+      if (!shown[i] && alloc_sites[i].live_count &&
+          (best < 0 ||
+           alloc_sites[i].live_bytes > alloc_sites[best].live_bytes)) {
+        best = i;
+      }
+    }
+    if (best < 0) {
+      break;
+    }
+    shown[best] = 1;
+    alloc_site_t *s = &alloc_sites[best];
+    len = meminfo_append(buf, size, len, "0x%p  %l\t%u\t%l\n", s->caller,
+                         s->live_bytes, s->live_count, s->allocs);
+  }
+  unlock();
+  return len;
+}
+#else
+uint32_t alloc_profile_render(char *buf, uint32_t size) {
+  return meminfo_append(buf, size, 0,
+                        "Allocation profiling is off; build with `make "
+                        "ALLOC_PROFILE=1`.\n");
+}
+#endif
+
+void alloc_profile_print() {
+  char *buf = vmalloc(ALLOC_PROFILE_BUF_SIZE);
+  if (!buf) {
+    return;
+  }
+  alloc_profile_render(buf, ALLOC_PROFILE_BUF_SIZE);
+  for (char *c = buf; *c; ++c) {
+    if (*c == '\n') {
+      uart_putc('\r');
+    }
+    uart_putc(*c);
+  }
+  vfree(buf);
+}
@@ -1,21 +1,33 @@
 #include "include/allocator.h"
+#include "include/alloc_profile.h"
 #include "include/buddy_system.h"
-#include "include/dlist.h"
 #include "include/exception.h"
-#include "include/heap.h"
+#include "include/slab.h"
 #include "include/types.h"
 #include "include/uart.h"
+#include "include/utils.h"
 
-extern double_linked_node_t pools[];
+extern kmem_cache_t *pools[];
 extern const uint32_t SMALL_SIZES[];
+extern kmem_cache_t *large_pools[];
+extern const uint32_t LARGE_SIZES[];
 extern frame_array_node_t frame_array[];
 
+static kmem_cache_t *memory_pool_create(uint32_t size) {
+  char name[KMEM_CACHE_NAME_MAX + 1];
+  char num[12];
+  str_uint_to_decimal(num, size);
+  strcpy(name, "size-");
+  strcat(name, num);
+  return kmem_cache_create(name, size);
+}
+
 void memory_pool_init() {
   for (uint32_t i = 0; i < SMALL_SIZES_COUNT; ++i) {
-    double_linked_init(&pools[i]);
+    pools[i] = memory_pool_create(SMALL_SIZES[i]);
   }
-  for (uint32_t i = 0; i < SMALL_SIZES_COUNT; ++i) {
-    memory_pool_allocator(SMALL_SIZES[i], 0);
+  for (uint32_t i = 0; i < LARGE_SIZES_COUNT; ++i) {
+    large_pools[i] = memory_pool_create(LARGE_SIZES[i]);
   }
 }
 
@@ -29,120 +41,103 @@ int memory_pool_find_pool_index(uint32_t size) {
 }
 
 void *memory_pool_allocator(uint32_t size, int show_info) {
-  lock();
   int pool_index = memory_pool_find_pool_index(size);
   if (pool_index == -1) {
-    uart_sendline("[Small Allocator Error]\n");
-    while (1) {
-    }
-    unlock();
+    uart_sendline("[Small Allocator Error] No pool for %u bytes.\n", size);
     return NULL;
   }
 
-  double_linked_node_t *head_i = &pools[pool_index];
-  double_linked_node_t *cur;
-  frame_array_node_t *entry = NULL;
+  alloc_profile_enter();
+  void *allocated_address = kmem_cache_alloc(pools[pool_index]);
+  alloc_profile_exit();
+  if (!allocated_address) {
+    return NULL;
+  }
+  alloc_profile_tag(allocated_address, size, alloc_profile_caller());
+  if (show_info) {
+    uart_sendline("[Small Allocator] Allocated %u bytes from %s. Address: "
+                  "0x%p\n",
+                  size, pools[pool_index]->name, allocated_address);
+  }
+  return allocated_address;
+}
 
-  double_linked_for_each(cur, head_i) {
-    frame_array_node_t *cur_entry = (frame_array_node_t *)cur;
-    if (cur_entry->slot_count > 0) {
-      entry = cur_entry;
-      break;
-    }
+void memory_pool_free(void *address, int show_info) {
+  kmem_cache_t *cache = kmem_cache_of(address);
+  if (!cache) {
+    uart_sendline("[Small Allocator Error] Bad free of 0x%p.\n", address);
+    return;
   }
 
-  uint32_t slots_size = SMALL_SIZES[pool_index];
-  uint32_t slots = PAGE_SIZE / slots_size;
-  if (!entry) {
-    uint64_t new_page_addr = buddy_system_allocator(PAGE_SIZE);
-    if (!new_page_addr) {
-      uart_sendline("[Small Allocator Error]\n");
-      while (1) {
-      }
-      unlock();
-      return NULL;
-    }
-    entry = &frame_array[(new_page_addr - BUDDY_MEMORY_BASE) / PAGE_SIZE];
-    double_linked_add_after(&entry->node, head_i);
-    simple_memset(entry->slot_bitmap, 0xFF, (slots + 7) / 8);
-    entry->slot_size = slots_size;
-    entry->slot_count = slots;
+  alloc_profile_untag(address);
+  alloc_profile_enter();
+  kmem_cache_free(cache, address);
+  alloc_profile_exit();
+  if (show_info) {
+    uart_sendline("[Small Allocator] Freed object of %s. Address: 0x%p\n",
+                  cache->name, address);
   }
+}
 
-  for (uint32_t i = 0; i < slots; ++i) {
-    uint32_t byte_index = i / 8;
-    uint32_t bit_index = i % 8;
-    if (entry->slot_bitmap[byte_index] & (1 << bit_index)) {
-      entry->slot_bitmap[byte_index] &= ~(1 << bit_index);
-      entry->slot_count--;
-      void *allocated_address =
-          (void *)(((uint64_t)entry->index * PAGE_SIZE) + (i * slots_size));
-      if (show_info) {
-        uart_sendline(
-            "[Small Allocator] Allocated slot %u in frame %u, %u slots "
-            "remaining. Address: 0x%p\n",
-            i, entry->index, entry->slot_count, allocated_address);
-      }
-      unlock();
-      return BUDDY_MEMORY_BASE + allocated_address;
+// Small sizes go to the size-N caches, up to 16 KB to the page-multiple
+// caches and anything larger straight to the buddy system. A zeroed single
+// page is a plain buddy page from the zero pool.
+static void *kmalloc_node(uint32_t size, uint32_t flags) {
+  if (flags & __GFP_ZERO) {
+    uint64_t page = 0;
+    if (size == PAGE_SIZE) {
+      alloc_pages_bulk(1, &page, flags);
+      return (void *)page;
+    }
+    void *ptr = kmalloc_node(size, flags & ~__GFP_ZERO);
+    if (ptr) {
+      memset(ptr, 0, size);
     }
+    return ptr;
   }
-  uart_sendline("[Small Allocator Error]\n");
-  while (1) {
+  int pool_index = memory_pool_find_pool_index(size);
+  if (pool_index != -1) {
+    return kmem_cache_alloc(pools[pool_index]);
   }
-  unlock();
-  return NULL;
-}
-
-void memory_pool_free(void *address, int show_info) {
-  lock();
-  address = address - BUDDY_MEMORY_BASE;
-  if (!address) {
-    uart_sendline("[Small Allocator Error]\n");
-    while (1) {
+  for (uint32_t i = 0; i < LARGE_SIZES_COUNT; ++i) {
+    if (LARGE_SIZES[i] >= size) {
+      return kmem_cache_alloc(large_pools[i]);
     }
-    unlock();
-    return;
   }
+  return (void *)buddy_system_allocator(size);
+}
 
-  uint64_t addr = (uint64_t)address;
-  uint32_t page_index = addr / PAGE_SIZE;
-  uint32_t offset_within_page = addr % PAGE_SIZE;
+void *kmalloc(uint32_t size, uint32_t flags) {
+  alloc_profile_enter();
+  void *ptr = kmalloc_node(size, flags);
+  alloc_profile_exit();
+  alloc_profile_tag(ptr, size, alloc_profile_caller());
+  return ptr;
+}
 
-  frame_array_node_t *frame = &frame_array[page_index];
-  if (!frame->slot_size) {
-    uart_sendline("[Small Allocator Error]\n");
-    while (1) {
-    }
-    unlock();
+// The frame descriptor tells whether the block belongs to a slab cache or
+// came from the buddy system directly.
+void kfree(void *ptr) {
+  if (!ptr) {
     return;
   }
-
-  uint32_t slot_index = offset_within_page / frame->slot_size;
-  uint32_t byte_index = slot_index / 8;
-  uint32_t bit_index = slot_index % 8;
-  if (frame->slot_bitmap[byte_index] & (1 << bit_index)) {
-    uart_sendline("[Small Allocator Error]\n");
-    while (1) {
-    }
-    unlock();
+  alloc_profile_untag(ptr);
+  alloc_profile_enter();
+  kmem_cache_t *cache = kmem_cache_of(ptr);
+  if (cache) {
+    kmem_cache_free(cache, ptr);
+    alloc_profile_exit();
     return;
   }
-
-  frame->slot_bitmap[byte_index] |= (1 << bit_index);
-  frame->slot_count++;
-  if (show_info) {
-    uart_sendline("[Small Allocator] Freed slot %u in frame %u, %u slots now "
-                  "free. Address: 0x%p\n",
-                  slot_index, page_index, frame->slot_count, address);
-  }
-
-  if (frame->slot_count == (PAGE_SIZE / frame->slot_size)) {
-    double_linked_remove(&frame->node);
-    simple_memset(frame->slot_bitmap, 0, (frame->slot_count + 7) / 8);
-    frame->slot_size = 0;
-    frame->slot_count = 0;
-    buddy_system_free(BUDDY_MEMORY_BASE + page_index * PAGE_SIZE);
+  uint32_t frame = ((uint64_t)ptr - BUDDY_MEMORY_BASE) / PAGE_SIZE;
+  if ((uint64_t)ptr < BUDDY_MEMORY_BASE ||
+      (uint64_t)ptr >= BUDDY_MEMORY_BASE + TOTAL_MEMORY ||
+      ((uint64_t)ptr & (PAGE_SIZE - 1)) ||
+      !(frame_array[frame].flags & FRAME_ALLOCATED)) {
+    uart_sendline("[Allocator Error] Bad kfree of 0x%p.\n", ptr);
+    alloc_profile_exit();
+    return;
   }
-  unlock();
-}
\ No newline at end of file
+  buddy_system_free((uint64_t)ptr);
+  alloc_profile_exit();
+}
@@ -1,169 +1,774 @@
 #include "include/buddy_system.h"
+#include "include/alloc_profile.h"
+#include "include/alloc_trace.h"
 #include "include/allocator.h"
 #include "include/exception.h"
 #include "include/heap.h"
+#include "include/shrinker.h"
+#include "include/timer.h"
 #include "include/types.h"
 #include "include/uart.h"
 #include "include/utils.h"
 
 extern buddy_system_node_t buddy_system[];
 extern frame_array_node_t frame_array[];
+extern uint64_t buddy_system_free_levels;
+extern uint64_t buddy_system_type_levels[];
+extern uint8_t buddy_system_pageblock_type[];
+extern int (*buddy_system_migrate)(uint64_t from, uint64_t to);
+extern uint64_t buddy_system_free_pages;
+extern buddy_system_stats_t buddy_system_stats;
+extern buddy_system_magazine_t buddy_system_magazines[];
+extern buddy_system_zero_pool_t buddy_system_zero_pool;
 extern startup_memory_block_t *startup_memory_block_table_start;
+extern startup_memory_block_t *startup_memory_block_table_end;
+
+static inline int buddy_system_test_bit(uint32_t level, uint32_t index) {
+  return (buddy_system[level].bitmap[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void buddy_system_set_bit(uint32_t level, uint32_t index) {
+  buddy_system[level].bitmap[index >> 6] |= 1UL << (index & 63);
+}
+
+static inline void buddy_system_clear_bit(uint32_t level, uint32_t index) {
+  buddy_system[level].bitmap[index >> 6] &= ~(1UL << (index & 63));
+}
+
+void frame_list_add(uint32_t *head, uint32_t index) {
+  frame_array[index].prev = FRAME_NONE;
+  frame_array[index].next = *head;
+  if (*head != FRAME_NONE) {
+    frame_array[*head].prev = index;
+  }
+  *head = index;
+}
+
+void frame_list_remove(uint32_t *head, uint32_t index) {
+  frame_array_node_t *frame = &frame_array[index];
+  if (frame->prev != FRAME_NONE) {
+    frame_array[frame->prev].next = frame->next;
+  } else {
+    *head = frame->next;
+  }
+  if (frame->next != FRAME_NONE) {
+    frame_array[frame->next].prev = frame->prev;
+  }
+  frame->next = FRAME_NONE;
+  frame->prev = FRAME_NONE;
+}
+
+static inline uint32_t buddy_system_type_of(uint32_t frame_index) {
+  return buddy_system_pageblock_type[frame_index >> PAGEBLOCK_ORDER];
+}
+
+// Put a free block on its level's freelist and mark the level non-empty.
+static inline void buddy_system_push(uint32_t level, uint32_t block_index) {
+  uint32_t type = buddy_system_type_of(block_index << level);
+  buddy_system_set_bit(level, block_index);
+  frame_list_add(&buddy_system[level].head[type], block_index << level);
+  buddy_system_free_levels |= 1UL << level;
+  buddy_system_type_levels[type] |= 1UL << level;
+  buddy_system_free_pages += 1UL << level;
+  buddy_system[level].count++;
+}
+
+static inline void buddy_system_pop(uint32_t level, uint32_t block_index) {
+  uint32_t type = buddy_system_type_of(block_index << level);
+  buddy_system_clear_bit(level, block_index);
+  frame_list_remove(&buddy_system[level].head[type], block_index << level);
+  buddy_system_free_pages -= 1UL << level;
+  buddy_system[level].count--;
+  if (buddy_system[level].head[type] == FRAME_NONE) {
+    buddy_system_type_levels[type] &= ~(1UL << level);
+  }
+  if (buddy_system[level].count == 0) {
+    buddy_system_free_levels &= ~(1UL << level);
+  }
+}
+
+static inline void buddy_system_mark_allocated(uint32_t frame_index,
+                                               uint32_t level) {
+  frame_array[frame_index].order = level;
+  frame_array[frame_index].flags = FRAME_ALLOCATED;
+}
+
+// A block parked in a magazine or the zero pool is free as far as its last
+// owner is concerned, so freeing it again is caught like any double free.
+static inline void buddy_system_mark_cached(uint32_t frame_index,
+                                            uint32_t level) {
+  frame_array[frame_index].order = level;
+  frame_array[frame_index].flags = FRAME_CACHED;
+}
+
+static uint32_t buddy_system_magazine_count();
+static uint32_t buddy_system_magazine_shrink(uint32_t nr_pages);
+static uint32_t buddy_system_zero_pool_count();
+static uint32_t buddy_system_zero_pool_shrink(uint32_t nr_pages);
+
+static inline uint32_t buddy_system_blocks(uint32_t level) {
+  return TOTAL_MEMORY >> (PAGE_SHIFT + level);
+}
 
 void buddy_system_init() {
   uart_sendline("============================\n");
   uart_sendline("Buddy system initializing...\n");
   uart_sendline("Total memory: 0x%p bytes.\n", TOTAL_MEMORY);
   for (uint32_t i = 0; i <= MAX_LEVEL; ++i) {
-    uint32_t blocks = TOTAL_MEMORY / (PAGE_SIZE << i);
+    uint32_t blocks = buddy_system_blocks(i);
+    uint32_t words = (blocks + 63) / 64;
     uart_sendline("Level %u:\n", i);
     uart_sendline("  Total blocks: %u.\n", blocks);
-    buddy_system[i].bitmap = simple_malloc((blocks + 7) / 8, 0);
-    double_linked_init(&buddy_system[i].head);
-    if (i == 0) {
-      simple_memset(buddy_system[i].bitmap, 0xFF, (blocks + 7) / 8);
-    }
-  }
-  for (uint32_t i = 0; i < TOTAL_MEMORY / PAGE_SIZE; ++i) {
-    double_linked_init(&frame_array[i].node);
-    frame_array[i].size = 0;
-    frame_array[i].index = i;
-    frame_array[i].slot_bitmap =
-        simple_malloc((PAGE_SIZE / SMALLEST_SIZE + 7) / 8, 0);
-    frame_array[i].slot_count = 0;
-    frame_array[i].slot_size = 0;
-    frame_array[i].ref = 0;
+    buddy_system[i].bitmap = simple_malloc(words * sizeof(uint64_t), 0);
+    for (uint32_t type = 0; type < MIGRATE_TYPES; ++type) {
+      buddy_system[i].head[type] = FRAME_NONE;
+    }
+    buddy_system[i].count = 0;
+  }
+  buddy_system_free_levels = 0;
+  for (uint32_t type = 0; type < MIGRATE_TYPES; ++type) {
+    buddy_system_type_levels[type] = 0;
   }
+  buddy_system_free_pages = 0;
+  for (uint32_t i = 0; i < MAGAZINE_LEVELS; ++i) {
+    buddy_system_magazines[i].count = 0;
+    buddy_system_magazines[i].low = MAGAZINE_DEFAULT_LOW >> i;
+    buddy_system_magazines[i].high = MAGAZINE_DEFAULT_HIGH >> i;
+  }
+  buddy_system_zero_pool.count = 0;
+  buddy_system_zero_pool.target = ZERO_POOL_DEFAULT_TARGET;
+  // frame_array lives in .bss, so every descriptor already starts zeroed
   uart_sendline("============================\n");
-  buddy_system_reserve_memory_init();
-  buddy_system_merge_bottom_up();
   buddy_system_freelists_init();
+  register_shrinker("page magazines", buddy_system_magazine_count,
+                    buddy_system_magazine_shrink);
+  register_shrinker("zero pool", buddy_system_zero_pool_count,
+                    buddy_system_zero_pool_shrink);
 }
 
 uint32_t buddy_system_find_level(uint32_t size) {
-  uint32_t level = 0;
-  uint32_t block_size = PAGE_SIZE;
-  while (block_size < size && level < MAX_LEVEL) {
-    block_size <<= 1;
-    level++;
+  if (size <= PAGE_SIZE) {
+    return 0;
   }
-  return level;
+  // ceil(log2(pages)) = bit width of (pages - 1)
+  return 32 - __builtin_clz((size - 1) >> PAGE_SHIFT);
 }
 
 uint32_t size_to_power_of_two(uint32_t size) {
-  uint32_t power = 0;
-  while ((1 << power) < size) {
-    power++;
+  if (size <= 1) {
+    return 1;
   }
-  return 1 << power;
+  return 1U << (32 - __builtin_clz(size - 1));
 }
 
+// Take one block of `level` and mobility `type` off the freelists,
+// splitting a larger one if needed. When the type has nothing that fits, a
+// whole free pageblock of the other type changes hands; only if none is
+// left does the request borrow a smaller block and mix the two. Returns the
+// first frame index, or -1 when memory is exhausted.
+static int buddy_system_alloc_block(uint32_t level, uint32_t type) {
+  if (level > MAX_LEVEL) {
+    return -1;
+  }
+  // lowest non-empty level that can hold the request
+  uint32_t from = type;
+  uint64_t candidates = buddy_system_type_levels[type] & (~0UL << level);
+  uint32_t whole = level > PAGEBLOCK_ORDER ? level : PAGEBLOCK_ORDER;
+  for (uint32_t i = 0; !candidates && i < MIGRATE_TYPES; ++i) {
+    candidates = buddy_system_type_levels[i] & (~0UL << whole);
+    from = i;
+  }
+  for (uint32_t i = 0; !candidates && i < MIGRATE_TYPES; ++i) {
+    candidates = buddy_system_type_levels[i] & (~0UL << level);
+    from = i;
+  }
+  if (!candidates) {
+    return -1;
+  }
+
+  uint32_t current_level = __builtin_ctzl(candidates);
+  uint32_t block_index =
+      buddy_system[current_level].head[from] >> current_level;
+  buddy_system_pop(current_level, block_index);
+  if (from != type && current_level >= PAGEBLOCK_ORDER) {
+    uint32_t pageblock = (block_index << current_level) >> PAGEBLOCK_ORDER;
+    uint32_t count = level > PAGEBLOCK_ORDER ? 1U << (level - PAGEBLOCK_ORDER)
+                                             : 1;
+    for (uint32_t i = 0; i < count; ++i) {
+      buddy_system_pageblock_type[pageblock + i] = type;
+    }
+    buddy_system_stats.steals += count;
+  } else if (from != type) {
+    buddy_system_stats.fallbacks++;
+  }
+
+  // split, handing the upper halves back to the lower levels
+  while (current_level > level) {
+    current_level--;
+    block_index <<= 1;
+    buddy_system_push(current_level, block_index + 1);
+    buddy_system_stats.splits++;
+  }
+
+  buddy_system_mark_allocated(block_index << level, level);
+  return block_index << level;
+}
+
+static void buddy_system_free_block(uint32_t frame_index, uint32_t level) {
+  frame_array[frame_index].flags = 0;
+  uint32_t block_index = frame_index >> level;
+  while (level < MAX_LEVEL) {
+    uint32_t buddy_index = block_index ^ 1;
+    if (buddy_index >= buddy_system_blocks(level) ||
+        !buddy_system_test_bit(level, buddy_index)) {
+      break;
+    }
+    buddy_system_pop(level, buddy_index);
+    block_index >>= 1;
+    level++;
+    buddy_system_stats.merges++;
+  }
+  buddy_system_push(level, block_index);
+}
+
+// Refill a magazine up to its low watermark. Pulls the biggest block that
+// does not overshoot and chops it, so a refill costs one split at most.
+static void buddy_system_magazine_refill(uint32_t level) {
+  buddy_system_magazine_t *mag = &buddy_system_magazines[level];
+  while (mag->count < mag->low) {
+    uint32_t want = 31 - __builtin_clz(mag->low - mag->count);
+    uint32_t target = level + want;
+    if (target > MAX_LEVEL) {
+      target = MAX_LEVEL;
+    }
+    uint64_t fits = buddy_system_free_levels & (~0UL << level) &
+                    ((1UL << (target + 1)) - 1);
+    if (fits) {
+      target = 63 - __builtin_clzl(fits);
+    }
+    int frame_index = buddy_system_alloc_block(target, MIGRATE_UNMOVABLE);
+    if (frame_index < 0) {
+      return;
+    }
+    for (uint32_t i = 0; i < (1U << (target - level)); ++i) {
+      uint32_t block = frame_index + (i << level);
+      buddy_system_mark_cached(block, level);
+      mag->blocks[mag->count++] = block;
+    }
+    mag->refills++;
+  }
+}
+
+// Give blocks back to the buddy lists until the magazine is at its low mark.
+static void buddy_system_magazine_drain(uint32_t level, uint32_t target) {
+  buddy_system_magazine_t *mag = &buddy_system_magazines[level];
+  while (mag->count > target) {
+    buddy_system_free_block(mag->blocks[--mag->count], level);
+  }
+  mag->drains++;
+}
+
+static inline void buddy_system_account(uint64_t start, int is_alloc) {
+  uint64_t ticks = timer_get_counter() - start;
+  if (is_alloc) {
+    buddy_system_stats.alloc_count++;
+    buddy_system_stats.alloc_ticks += ticks;
+    if (ticks > buddy_system_stats.alloc_max_ticks) {
+      buddy_system_stats.alloc_max_ticks = ticks;
+    }
+  } else {
+    buddy_system_stats.free_count++;
+    buddy_system_stats.free_ticks += ticks;
+    if (ticks > buddy_system_stats.free_max_ticks) {
+      buddy_system_stats.free_max_ticks = ticks;
+    }
+  }
+}
+
+static int buddy_system_take(uint32_t level) {
+  int frame_index = -1;
+  if (level < MAGAZINE_LEVELS) {
+    buddy_system_magazine_t *mag = &buddy_system_magazines[level];
+    if (mag->count == 0) {
+      mag->misses++;
+      buddy_system_magazine_refill(level);
+    } else {
+      mag->hits++;
+    }
+    if (mag->count > 0) {
+      frame_index = mag->blocks[--mag->count];
+      buddy_system_mark_allocated(frame_index, level);
+    } else {
+      // still empty after the refill: take one block off the lists directly
+      frame_index = buddy_system_alloc_block(level, MIGRATE_UNMOVABLE);
+    }
+  } else {
+    frame_index = buddy_system_alloc_block(level, MIGRATE_UNMOVABLE);
+  }
+  return frame_index;
+}
+
+// Returns 0 when the request cannot be met even after asking the shrinkers.
 uint64_t buddy_system_allocator(uint32_t size) {
   lock();
+  uint64_t start = timer_get_counter();
   uint32_t level = buddy_system_find_level(size);
-  size = size_to_power_of_two(size);
-  size = size < PAGE_SIZE ? PAGE_SIZE : size;
-  for (uint32_t current_level = level; current_level <= MAX_LEVEL;
-       current_level++) {
-    if (!double_linked_is_empty(&buddy_system[current_level].head)) {
-      frame_array_node_t *frame_node =
-          (frame_array_node_t *)buddy_system[current_level].head.next;
-      uint32_t block_index = frame_node->index / (1 << current_level);
-
-      buddy_system[current_level].bitmap[block_index / 8] &=
-          ~(1 << (block_index % 8));
-      double_linked_remove((double_linked_node_t *)frame_node);
-
-      uint32_t split_index = block_index;
-      while (current_level > level) {
-        uint32_t next_level = current_level - 1;
-        uint32_t buddy_index_1 = split_index * 2;
-        uint32_t buddy_index_2 = buddy_index_1 + 1;
-
-        buddy_system[next_level].bitmap[buddy_index_2 / 8] |=
-            (1 << (buddy_index_2 % 8));
-        double_linked_add_before(
-            (double_linked_node_t
-                 *)&frame_array[buddy_index_2 * (1 << next_level)],
-            &buddy_system[next_level].head);
-
-        current_level = next_level;
-        split_index = buddy_index_1;
-      }
-
-      uint64_t address = split_index * (PAGE_SIZE << level);
-      frame_array[split_index * (1 << level)].size = size;
-      unlock();
-      return BUDDY_MEMORY_BASE + address;
-    }
+  if (buddy_system_free_pages < SHRINK_LOW_PAGES) {
+    shrink_memory(SHRINK_HIGH_PAGES - buddy_system_free_pages);
+  }
+  int frame_index = buddy_system_take(level);
+  if (frame_index < 0 && level <= MAX_LEVEL) {
+    shrink_memory(1U << level);
+    frame_index = buddy_system_take(level);
+  }
+  if (frame_index < 0 && buddy_system_compact(level) == 0) {
+    frame_index = buddy_system_take(level);
   }
-  uart_sendline("[Allocator Error]\n");
-  while (1) {
+  if (frame_index < 0) {
+    uart_sendline("[Allocator Error] Out of memory for %u bytes.\n", size);
+    buddy_system_stats.failures++;
+    unlock();
+    return 0;
   }
+  buddy_system_stats.order_allocs[level]++;
+  buddy_system_account(start, 1);
+  uint64_t address = BUDDY_MEMORY_BASE + ((uint64_t)frame_index << PAGE_SHIFT);
+  alloc_trace("P %u 0x%p\n", size, address);
+  alloc_profile_tag((void *)address, size, alloc_profile_caller());
   unlock();
-  return 0;
+  return address;
+}
+
+// Return an allocated block to its magazine or to the buddy lists. Movable
+// pages skip the magazines, which only feed kernel allocations.
+static void buddy_system_release(uint32_t frame_index) {
+  uint32_t level = frame_array[frame_index].order;
+  if (level < MAGAZINE_LEVELS &&
+      !(frame_array[frame_index].flags & FRAME_MOVABLE)) {
+    buddy_system_magazine_t *mag = &buddy_system_magazines[level];
+    if (mag->count >= mag->high) {
+      buddy_system_magazine_drain(level, mag->low);
+    }
+    buddy_system_mark_cached(frame_index, level);
+    mag->blocks[mag->count++] = frame_index;
+  } else {
+    buddy_system_free_block(frame_index, level);
+  }
+  buddy_system_stats.order_frees[level]++;
 }
 
 void buddy_system_free(uint64_t address) {
   lock();
+  alloc_trace("p 0x%p\n", address);
+  alloc_profile_untag((void *)address);
+  uint64_t start = timer_get_counter();
   address = address - BUDDY_MEMORY_BASE;
-  frame_array_node_t *frame_node = &frame_array[address / PAGE_SIZE];
-  uint32_t size = frame_node->size;
-  if (size == 0) {
+  uint32_t frame_index = address / PAGE_SIZE;
+  if (!(frame_array[frame_index].flags & FRAME_ALLOCATED)) {
     uart_sendline("[Allocator Error]\n");
     while (1) {
     }
     unlock();
     return;
   }
-  frame_array[address / PAGE_SIZE].size = 0;
 
-  uint32_t level = buddy_system_find_level(size);
-  uint32_t block_index = address / (PAGE_SIZE << level);
-  buddy_system[level].bitmap[block_index / 8] |= (1 << (block_index % 8));
-  double_linked_add_before((double_linked_node_t *)frame_node,
-                           &buddy_system[level].head);
+  buddy_system_release(frame_index);
+  buddy_system_account(start, 0);
+  unlock();
+}
 
-  while (level < MAX_LEVEL) {
-    uint32_t block_size = PAGE_SIZE << level;
-    uint32_t parent_index = block_index / 2;
-    uint32_t buddy_index = block_index ^ 1;
+// Fill pages[] with nr_pages single pages under one lock. The order-0
+// magazine is emptied first and the rest is cut from the largest free blocks
+// that fit, so a whole process image costs a handful of buddy operations.
+// __GFP_MOVABLE pages come from movable pageblocks and bypass the magazine.
+// __GFP_ZERO kernel pages come out of the zero pool while it lasts; the rest
+// are cleared here, outside the lock.
+// Returns nr_pages, or 0 with nothing allocated when memory runs out.
+uint32_t alloc_pages_bulk(uint32_t nr_pages, uint64_t *pages,
+                          uint32_t flags) {
+  lock();
+  uint64_t start = timer_get_counter();
+  uint32_t type =
+      flags & __GFP_MOVABLE ? MIGRATE_MOVABLE : MIGRATE_UNMOVABLE;
+  buddy_system_magazine_t *mag = &buddy_system_magazines[0];
+  if (buddy_system_free_pages + mag->count < SHRINK_LOW_PAGES + nr_pages) {
+    shrink_memory(SHRINK_HIGH_PAGES + nr_pages - buddy_system_free_pages -
+                  mag->count);
+  }
 
-    if (buddy_index < (TOTAL_MEMORY / block_size) &&
-        (buddy_system[level].bitmap[buddy_index / 8] &
-         (1 << (buddy_index % 8))) != 0) {
-      buddy_system[level].bitmap[block_index / 8] &= ~(1 << (block_index % 8));
-      double_linked_remove(
-          (double_linked_node_t *)&frame_array[block_index * (1 << level)]);
-      buddy_system[level].bitmap[buddy_index / 8] &= ~(1 << (buddy_index % 8));
-      double_linked_remove(
-          (double_linked_node_t *)&frame_array[buddy_index * (1 << level)]);
-
-      block_index = parent_index;
-      level++;
-      buddy_system[level].bitmap[block_index / 8] |= (1 << (block_index % 8));
-      double_linked_add_before(
-          (double_linked_node_t *)&frame_array[block_index * (1 << level)],
-          &buddy_system[level].head);
-    } else {
+  uint32_t count = 0;
+  if ((flags & __GFP_ZERO) && type == MIGRATE_UNMOVABLE) {
+    buddy_system_zero_pool_t *pool = &buddy_system_zero_pool;
+    while (count < nr_pages && pool->count > 0) {
+      pages[count++] = pool->pages[--pool->count];
+      buddy_system_mark_allocated(pages[count - 1], 0);
+    }
+    pool->hits += count;
+    pool->misses += nr_pages - count;
+  }
+  uint32_t zeroed = (flags & __GFP_ZERO) ? count : nr_pages;
+  while (type == MIGRATE_UNMOVABLE && count < nr_pages && mag->count > 0) {
+    pages[count++] = mag->blocks[--mag->count];
+    buddy_system_mark_allocated(pages[count - 1], 0);
+  }
+  while (count < nr_pages) {
+    uint32_t level = 31 - __builtin_clz(nr_pages - count);
+    level = level < MAX_LEVEL ? level : MAX_LEVEL;
+    uint64_t fits =
+        buddy_system_type_levels[type] & ((1UL << (level + 1)) - 1);
+    if (fits) {
+      level = 63 - __builtin_clzl(fits);
+    }
+    int frame_index = buddy_system_alloc_block(level, type);
+    if (frame_index < 0) {
+      break;
+    }
+    for (uint32_t i = 0; i < (1U << level); ++i) {
+      buddy_system_mark_allocated(frame_index + i, 0);
+      if (type == MIGRATE_MOVABLE) {
+        frame_array[frame_index + i].flags |= FRAME_MOVABLE;
+      }
+      pages[count++] = frame_index + i;
+    }
+  }
+
+  if (count < nr_pages) {
+    uart_sendline("[Allocator Error] Out of memory for %u pages.\n",
+                  nr_pages);
+    while (count > 0) {
+      buddy_system_free_block(pages[--count], 0);
+    }
+    buddy_system_stats.failures++;
+    unlock();
+    return 0;
+  }
+  for (uint32_t i = 0; i < nr_pages; ++i) {
+    pages[i] = BUDDY_MEMORY_BASE + (pages[i] << PAGE_SHIFT);
+    alloc_trace("P %u 0x%p\n", PAGE_SIZE, pages[i]);
+    alloc_profile_tag((void *)pages[i], PAGE_SIZE, alloc_profile_caller());
+  }
+  buddy_system_stats.order_allocs[0] += nr_pages;
+  buddy_system_account(start, 1);
+  unlock();
+  for (uint32_t i = zeroed; i < nr_pages; ++i) {
+    clear_page((void *)pages[i]);
+  }
+  return nr_pages;
+}
+
+// Free nr_pages blocks from pages[] under one lock. Each entry is the address
+// of an allocated block of any order, as buddy_system_free takes.
+void free_pages_bulk(uint32_t nr_pages, uint64_t *pages) {
+  lock();
+  uint64_t start = timer_get_counter();
+  for (uint32_t i = 0; i < nr_pages; ++i) {
+    alloc_trace("p 0x%p\n", pages[i]);
+    alloc_profile_untag((void *)pages[i]);
+    uint32_t frame_index = (pages[i] - BUDDY_MEMORY_BASE) / PAGE_SIZE;
+    if (!(frame_array[frame_index].flags & FRAME_ALLOCATED)) {
+      uart_sendline("[Allocator Error] Bad bulk free of 0x%p.\n", pages[i]);
+      continue;
+    }
+    buddy_system_release(frame_index);
+  }
+  buddy_system_account(start, 0);
+  unlock();
+}
+
+// One free 2MB block for a huge user mapping. Unlike buddy_system_allocator
+// this neither shrinks nor compacts: the caller falls back to single pages,
+// so a miss returns 0 quietly. Free it like any block.
+uint64_t alloc_huge_page() {
+  lock();
+  uint64_t start = timer_get_counter();
+  int frame_index = buddy_system_alloc_block(HUGE_PAGE_ORDER, MIGRATE_MOVABLE);
+  if (frame_index < 0) {
+    unlock();
+    return 0;
+  }
+  buddy_system_stats.order_allocs[HUGE_PAGE_ORDER]++;
+  buddy_system_account(start, 1);
+  uint64_t address = BUDDY_MEMORY_BASE + ((uint64_t)frame_index << PAGE_SHIFT);
+  alloc_trace("P %u 0x%p\n", HUGE_PAGE_SIZE, address);
+  alloc_profile_tag((void *)address, HUGE_PAGE_SIZE, alloc_profile_caller());
+  unlock();
+  return address;
+}
+
+// Adjust the user mapping count of nr_pages consecutive frames.
+void frame_ref_range(uint64_t phys_addr, uint32_t nr_pages, int delta) {
+  frame_array_node_t *frame = &frame_array[phys_addr / PAGE_SIZE];
+  for (uint32_t i = 0; i < nr_pages; ++i) {
+    frame[i].ref += delta;
+  }
+}
+
+// The VM layer moves a page's user mapping from one physical frame to
+// another; without it compaction only rebuilds blocks out of free memory.
+void buddy_system_register_migrate(int (*migrate)(uint64_t from,
+                                                  uint64_t to)) {
+  buddy_system_migrate = migrate;
+}
+
+// Level of the free block starting at frame, or -1 if it is not one.
+static int buddy_system_free_level(uint32_t frame) {
+  for (uint32_t level = 0; level <= MAX_LEVEL; ++level) {
+    if (frame & ((1U << level) - 1)) {
       break;
     }
+    if (buddy_system_test_bit(level, frame >> level)) {
+      return level;
+    }
+  }
+  return -1;
+}
+
+// Number of pages to migrate to free the aligned block of `level` at base,
+// or -1 if something pinned sits in it.
+static int buddy_system_compact_cost(uint32_t base, uint32_t level) {
+  int cost = 0;
+  uint32_t end = base + (1U << level);
+  for (uint32_t frame = base; frame < end;) {
+    frame_array_node_t *f = &frame_array[frame];
+    if (f->flags & FRAME_ALLOCATED) {
+      if (!(f->flags & FRAME_MOVABLE) || f->order != 0 || f->ref != 1) {
+        return -1;
+      }
+      cost++;
+      frame++;
+      continue;
+    }
+    int free_level = buddy_system_free_level(frame);
+    if (free_level < 0) {
+      return -1; // reserved at boot
+    }
+    frame += 1U << free_level;
   }
+  return cost;
+}
+
+// Copy one movable page out of the block being compacted. The old frame
+// stays isolated until the whole block is released.
+static int buddy_system_migrate_page(uint32_t frame) {
+  int target = buddy_system_alloc_block(0, MIGRATE_MOVABLE);
+  if (target < 0) {
+    return -1;
+  }
+  uint64_t from = (uint64_t)frame << PAGE_SHIFT;
+  uint64_t to = (uint64_t)target << PAGE_SHIFT;
+  memcpy((char *)(BUDDY_MEMORY_BASE + to), (char *)(BUDDY_MEMORY_BASE + from),
+         PAGE_SIZE);
+  if (buddy_system_migrate(from, to) != 0) {
+    buddy_system_free_block(target, 0);
+    return -1;
+  }
+  frame_array[target].flags |=
+      FRAME_MOVABLE | (frame_array[frame].flags & FRAME_PROFILED);
+  frame_array[target].cache = frame_array[frame].cache;
+  frame_array[target].ref = 1;
+  frame_array[frame].ref = 0;
+  frame_array[frame].flags |= FRAME_ISOLATED;
+  return 0;
+}
+
+// Rebuild a free block of `level` by migrating the user pages out of the
+// aligned block that needs the fewest moves. Free pieces of that block are
+// taken off the freelists first so migration targets land elsewhere.
+// Returns 0 once such a block is free.
+int buddy_system_compact(uint32_t level) {
+  if (level == 0 || level > MAX_LEVEL || !buddy_system_migrate) {
+    return -1;
+  }
+  lock();
+  if (buddy_system_free_levels & (~0UL << level)) {
+    unlock();
+    return 0;
+  }
+  uint64_t start = timer_get_counter();
+  buddy_system_stats.compact_runs++;
+  // cached blocks would pin the block being rebuilt
+  for (uint32_t i = 0; i < MAGAZINE_LEVELS; ++i) {
+    if (buddy_system_magazines[i].count) {
+      buddy_system_magazine_drain(i, 0);
+    }
+  }
+
+  uint32_t best = FRAME_NONE;
+  int best_cost = -1;
+  for (uint32_t base = 0; base < TOTAL_MEMORY / PAGE_SIZE;
+       base += 1U << level) {
+    int cost = buddy_system_compact_cost(base, level);
+    if (cost >= 0 && (best_cost < 0 || cost < best_cost)) {
+      best = base;
+      best_cost = cost;
+    }
+  }
+  if (best_cost < 0) {
+    buddy_system_stats.compact_ticks += timer_get_counter() - start;
+    unlock();
+    return -1;
+  }
+
+  uint32_t end = best + (1U << level);
+  for (uint32_t frame = best; frame < end;) {
+    if (frame_array[frame].flags & FRAME_ALLOCATED) {
+      frame++;
+      continue;
+    }
+    uint32_t free_level = buddy_system_free_level(frame);
+    buddy_system_pop(free_level, frame >> free_level);
+    buddy_system_mark_allocated(frame, free_level);
+    frame_array[frame].flags |= FRAME_ISOLATED;
+    frame += 1U << free_level;
+  }
+  for (uint32_t frame = best; frame < end;) {
+    frame_array_node_t *f = &frame_array[frame];
+    if (!(f->flags & FRAME_ISOLATED) &&
+        buddy_system_migrate_page(frame) == 0) {
+      buddy_system_stats.compact_migrated++;
+    }
+    frame += 1U << f->order;
+  }
+  for (uint32_t frame = best; frame < end;) {
+    uint32_t order = frame_array[frame].order;
+    if (frame_array[frame].flags & FRAME_ISOLATED) {
+      buddy_system_free_block(frame, order);
+    }
+    frame += 1U << order;
+  }
+
+  int ok = buddy_system_test_bit(level, best >> level) ? 0 : -1;
+  if (ok == 0) {
+    buddy_system_stats.compact_success++;
+  }
+  buddy_system_stats.compact_ticks += timer_get_counter() - start;
   unlock();
+  return ok;
+}
+
+// Largest block that starts at `frame` and ends at or before `end_frame`.
+static inline uint32_t buddy_system_max_level(uint32_t frame,
+                                              uint32_t end_frame) {
+  uint32_t level = frame ? __builtin_ctz(frame) : MAX_LEVEL;
+  uint32_t fit = 31 - __builtin_clz(end_frame - frame);
+  level = level < fit ? level : fit;
+  return level < MAX_LEVEL ? level : MAX_LEVEL;
+}
+
+// Hand a physical range of reserved frames back to the allocator, as the
+// largest aligned blocks that fit so they merge with free neighbours.
+void buddy_system_free_range(uint64_t start, uint64_t end) {
+  uint32_t frame = (start + PAGE_SIZE - 1) / PAGE_SIZE;
+  uint32_t end_frame = end / PAGE_SIZE;
+  lock();
+  while (frame < end_frame) {
+    uint32_t level = buddy_system_max_level(frame, end_frame);
+    for (uint32_t i = 0; i < (1U << level); ++i) {
+      frame_array[frame + i].flags = 0;
+    }
+    buddy_system_free_block(frame, level);
+    frame += 1U << level;
+  }
+  unlock();
+}
+
+// Called from the idle thread. Pages are cleared with interrupts enabled and
+// only the pool pushes and pops run under the lock.
+void buddy_system_zero_pool_fill(uint32_t budget) {
+  buddy_system_zero_pool_t *pool = &buddy_system_zero_pool;
+  while (budget-- > 0) {
+    lock();
+    int frame_index = -1;
+    if (pool->count < pool->target &&
+        buddy_system_free_pages > SHRINK_HIGH_PAGES) {
+      frame_index = buddy_system_take(0);
+    }
+    unlock();
+    if (frame_index < 0) {
+      return;
+    }
+    clear_page(
+        (void *)(BUDDY_MEMORY_BASE + ((uint64_t)frame_index << PAGE_SHIFT)));
+    lock();
+    if (pool->count < ZERO_POOL_CAPACITY) {
+      buddy_system_mark_cached(frame_index, 0);
+      pool->pages[pool->count++] = frame_index;
+      pool->filled++;
+    } else {
+      buddy_system_release(frame_index);
+    }
+    unlock();
+  }
+}
+
+static uint32_t buddy_system_zero_pool_count() {
+  return buddy_system_zero_pool.count;
+}
+
+static uint32_t buddy_system_zero_pool_shrink(uint32_t nr_pages) {
+  buddy_system_zero_pool_t *pool = &buddy_system_zero_pool;
+  uint32_t freed = 0;
+  while (pool->count > 0 && freed < nr_pages) {
+    buddy_system_release(pool->pages[--pool->count]);
+    freed++;
+  }
+  return freed;
+}
+
+// Only blocks above the low marks are offered: those are what the next
+// allocations would refill straight away.
+static uint32_t buddy_system_magazine_count() {
+  uint32_t pages = 0;
+  for (uint32_t i = 0; i < MAGAZINE_LEVELS; ++i) {
+    buddy_system_magazine_t *mag = &buddy_system_magazines[i];
+    if (mag->count > mag->low) {
+      pages += (mag->count - mag->low) << i;
+    }
+  }
+  return pages;
+}
+
+static uint32_t buddy_system_magazine_shrink(uint32_t nr_pages) {
+  uint32_t freed = 0;
+  for (uint32_t i = MAGAZINE_LEVELS; i-- > 0 && freed < nr_pages;) {
+    buddy_system_magazine_t *mag = &buddy_system_magazines[i];
+    if (mag->count <= mag->low) {
+      continue;
+    }
+    while (mag->count > mag->low && freed < nr_pages) {
+      buddy_system_free_block(mag->blocks[--mag->count], i);
+      freed += 1U << i;
+    }
+    mag->drains++;
+  }
+  return freed;
+}
+
+int buddy_system_magazine_set_watermark(uint32_t level, uint32_t low,
+                                        uint32_t high) {
+  // a zero low mark would leave the magazine empty after every refill
+  if (level >= MAGAZINE_LEVELS || low == 0 || low > high ||
+      high > MAGAZINE_CAPACITY) {
+    return -1;
+  }
+  lock();
+  buddy_system_magazine_t *mag = &buddy_system_magazines[level];
+  mag->low = low;
+  mag->high = high;
+  if (mag->count > high) {
+    buddy_system_magazine_drain(level, high);
+  }
+  unlock();
+  return 0;
 }
 
 void buddy_system_print_bitmap() {
   for (uint32_t level = 0; level <= MAX_LEVEL; level++) {
-    uint32_t blocks = TOTAL_MEMORY / (PAGE_SIZE << level);
+    uint32_t blocks = buddy_system_blocks(level);
     uart_sendline("[Bitmap] Level %u (%u blocks, %u bytes each): ", level,
                   blocks, PAGE_SIZE << level);
-    for (uint32_t i = 0; i < (blocks + 7) / 8; ++i) {
-      for (uint32_t bit = 0; bit < 8; bit++) {
-        if (8 * i + bit < blocks) {
-          uart_sendline("%u",
-                        buddy_system[level].bitmap[i] & (1 << bit) ? 1 : 0);
-        }
-      }
+    for (uint32_t i = 0; i < blocks; ++i) {
+      uart_sendline("%u", buddy_system_test_bit(level, i));
     }
     uart_sendline("\n");
   }
@@ -178,68 +783,107 @@ void buddy_system_print_freelists(int show_bitmap) {
     uart_sendline("[Freelists] Level %u: ", level);
     uart_sendline("[");
     int first = 1;
-    double_linked_node_t *cur;
-    double_linked_for_each(cur, &buddy_system[level].head) {
-      if (!first) {
-        uart_sendline(", ");
+    for (uint32_t type = 0; type < MIGRATE_TYPES; ++type) {
+      for (uint32_t cur = buddy_system[level].head[type]; cur != FRAME_NONE;
+           cur = frame_array[cur].next) {
+        if (!first) {
+          uart_sendline(", ");
+        }
+        first = 0;
+        uart_sendline("%u", cur);
       }
-      first = 0;
-      frame_array_node_t *frame_node = (frame_array_node_t *)cur;
-      uart_sendline("%u", frame_node->index);
     }
     uart_sendline("]\n");
   }
 }
 
-void buddy_system_reserve_memory(uint64_t start, uint64_t end) {
-  uint32_t start_index = start / PAGE_SIZE;
-  uint32_t end_index = end / PAGE_SIZE;
-  for (uint32_t idx = start_index; idx <= end_index; idx++) {
-    buddy_system[0].bitmap[idx / 8] &= ~(1 << idx % 8);
-    frame_array[idx].size = PAGE_SIZE;
+// Sort the startup reservations by address, relinking the list in place.
+static void buddy_system_sort_reserved() {
+  startup_memory_block_t *sorted = NULL;
+  startup_memory_block_t *cur = startup_memory_block_table_start;
+  while (cur) {
+    startup_memory_block_t *next = cur->next;
+    startup_memory_block_t **pos = &sorted;
+    while (*pos && (*pos)->address <= cur->address) {
+      pos = &(*pos)->next;
+    }
+    cur->next = *pos;
+    *pos = cur;
+    cur = next;
   }
-}
-
-void buddy_system_reserve_memory_init() {
-  startup_memory_block_t *current = startup_memory_block_table_start;
-  while (current != NULL) {
-    buddy_system_reserve_memory(VIRT_TO_PHYS(current->address),
-                                VIRT_TO_PHYS(current->address + current->size));
-    current = current->next;
+  startup_memory_block_table_start = sorted;
+  startup_memory_block_table_end = sorted;
+  while (sorted && sorted->next) {
+    sorted = sorted->next;
+  }
+  if (sorted) {
+    startup_memory_block_table_end = sorted;
   }
 }
 
-void buddy_system_merge_bottom_up() {
-  for (uint32_t level = 0; level < MAX_LEVEL; level++) {
-    uint32_t blocks = TOTAL_MEMORY / (PAGE_SIZE << level);
-    for (uint32_t block_index = 0; block_index < blocks; block_index += 2) {
-      if (block_index + 1 >= blocks)
-        continue;
-      uint32_t byte_index1 = block_index / 8;
-      uint32_t bit_index1 = block_index % 8;
-      uint32_t byte_index2 = (block_index + 1) / 8;
-      uint32_t bit_index2 = (block_index + 1) % 8;
-      if ((buddy_system[level].bitmap[byte_index1] & (1 << bit_index1)) &&
-          (buddy_system[level].bitmap[byte_index2] & (1 << bit_index2))) {
-        buddy_system[level].bitmap[byte_index1] &= ~(1 << bit_index1);
-        buddy_system[level].bitmap[byte_index2] &= ~(1 << bit_index2);
-        buddy_system[level + 1].bitmap[(block_index / 2) / 8] |=
-            (1 << ((block_index / 2) % 8));
-      }
+// Build the freelists straight from the gaps between reservations. Each gap
+// is cut into maximal aligned blocks, which can never be buddies of one
+// another, so they go onto the lists without any merging pass. With the
+// reservations sorted, overlapping or touching ones need no merging either:
+// a gap only starts past the furthest end seen so far.
+void buddy_system_freelists_init() {
+  buddy_system_sort_reserved();
+  uint32_t total_frames = TOTAL_MEMORY / PAGE_SIZE;
+  uint32_t frame = 0;
+  startup_memory_block_t *cur = startup_memory_block_table_start;
+  for (;;) {
+    uint32_t end_frame = total_frames;
+    if (cur) {
+      uint64_t start = VIRT_TO_PHYS(cur->address) / PAGE_SIZE;
+      end_frame = start < total_frames ? start : total_frames;
+    }
+    while (frame < end_frame) {
+      uint32_t level = buddy_system_max_level(frame, end_frame);
+      buddy_system_push(level, frame >> level);
+      frame += 1U << level;
+    }
+    if (!cur) {
+      break;
     }
+    uint64_t end = VIRT_TO_PHYS(cur->address + cur->size);
+    uint64_t end_reserved = (end + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (end_reserved > frame) {
+      frame = end_reserved < total_frames ? end_reserved : total_frames;
+    }
+    cur = cur->next;
   }
 }
 
-void buddy_system_freelists_init() {
-  for (uint32_t level = 0; level <= MAX_LEVEL; level++) {
-    uint32_t blocks = TOTAL_MEMORY / (PAGE_SIZE << level);
-    for (uint32_t block_index = 0; block_index < blocks; block_index++) {
-      if (buddy_system[level].bitmap[block_index / 8] &
-          (1 << (block_index % 8))) {
-        double_linked_add_before(
-            (double_linked_node_t *)&frame_array[block_index * (1 << level)],
-            &buddy_system[level].head);
-      }
-    }
+void buddy_system_print_stats() {
+  uint64_t freq = timer_get_frequency();
+  buddy_system_stats_t *s = &buddy_system_stats;
+  uint64_t alloc_avg = s->alloc_count ? s->alloc_ticks / s->alloc_count : 0;
+  uint64_t free_avg = s->free_count ? s->free_ticks / s->free_count : 0;
+  uart_sendline("[Buddy System] Free levels: 0x%p\n", buddy_system_free_levels);
+  uart_sendline("[Buddy System] Alloc: %l calls, avg %l ticks (%l ns), max %l "
+                "ticks\n",
+                s->alloc_count, alloc_avg, alloc_avg * 1000000000 / freq,
+                s->alloc_max_ticks);
+  uart_sendline("[Buddy System] Free: %l calls, avg %l ticks (%l ns), max %l "
+                "ticks\n",
+                s->free_count, free_avg, free_avg * 1000000000 / freq,
+                s->free_max_ticks);
+  uart_sendline("[Buddy System] Pageblocks: %l steals, %l fallbacks\n",
+                s->steals, s->fallbacks);
+  uart_sendline("[Compaction] %l runs, %l succeeded, %l pages migrated, %l "
+                "ticks\n",
+                s->compact_runs, s->compact_success, s->compact_migrated,
+                s->compact_ticks);
+  uart_sendline("[Zero Pool] %u cached (target %u), %l hits, %l misses, %l "
+                "filled by idle\n",
+                buddy_system_zero_pool.count, buddy_system_zero_pool.target,
+                buddy_system_zero_pool.hits, buddy_system_zero_pool.misses,
+                buddy_system_zero_pool.filled);
+  for (uint32_t i = 0; i < MAGAZINE_LEVELS; ++i) {
+    buddy_system_magazine_t *mag = &buddy_system_magazines[i];
+    uart_sendline("[Magazine] Level %u: %u cached (low %u, high %u), %l hits, "
+                  "%l misses, %l refills, %l drains\n",
+                  i, mag->count, mag->low, mag->high, mag->hits, mag->misses,
+                  mag->refills, mag->drains);
   }
-}
\ No newline at end of file
+}
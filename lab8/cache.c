@@ -0,0 +1,55 @@
+#include "include/cache.h"
+#include "include/types.h"
+
+static inline uint64_t cache_dline_size() {
+  uint64_t ctr;
+  asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+  return CTR_DMINLINE(ctr);
+}
+
+// Write dirty lines back to the point of coherency, e.g. before a device
+// (VideoCore mailbox, framebuffer) reads memory written by the CPU.
+void cache_clean_range(void *start, size_t size) {
+  uint64_t line = cache_dline_size();
+  uint64_t addr = (uint64_t)start & ~(line - 1);
+  for (; addr < (uint64_t)start + size; addr += line) {
+    asm volatile("dc cvac, %0" ::"r"(addr) : "memory");
+  }
+  asm volatile("dsb sy" ::: "memory");
+}
+
+// Drop lines so the next CPU read fetches what a device wrote to memory.
+void cache_invalidate_range(void *start, size_t size) {
+  uint64_t line = cache_dline_size();
+  uint64_t addr = (uint64_t)start & ~(line - 1);
+  for (; addr < (uint64_t)start + size; addr += line) {
+    asm volatile("dc ivac, %0" ::"r"(addr) : "memory");
+  }
+  asm volatile("dsb sy" ::: "memory");
+}
+
+void cache_clean_invalidate_range(void *start, size_t size) {
+  uint64_t line = cache_dline_size();
+  uint64_t addr = (uint64_t)start & ~(line - 1);
+  for (; addr < (uint64_t)start + size; addr += line) {
+    asm volatile("dc civac, %0" ::"r"(addr) : "memory");
+  }
+  asm volatile("dsb sy" ::: "memory");
+}
+
+// Make instructions written through the data cache (exec, COW of text pages)
+// visible to instruction fetch. The I-cache of Cortex-A53 is VIPT and user
+// code is written through its kernel alias, so invalidate the whole I-cache
+// instead of by VA.
+void cache_sync_icache_range(void *start, size_t size) {
+  uint64_t line = cache_dline_size();
+  uint64_t addr = (uint64_t)start & ~(line - 1);
+  for (; addr < (uint64_t)start + size; addr += line) {
+    asm volatile("dc cvau, %0" ::"r"(addr) : "memory");
+  }
+  asm volatile("dsb ish\n"
+               "ic ialluis\n"
+               "dsb ish\n"
+               "isb\n" ::
+                   : "memory");
+}
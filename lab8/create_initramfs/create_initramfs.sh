@@ -6,6 +6,10 @@
 # '-H FORMAT' archive format, 
 #    newc: SVR4 portable format
 
+# Then page-align the data of larger files so the kernel can map the
+# program text straight out of the archive instead of copying it.
+
+make -s -C ../tools/cpioalign || exit 1
 cd rootfs
-find . | cpio -o -H newc > ../initramfs.cpio
+find . | cpio -o -H newc | ../../tools/cpioalign/cpioalign > ../initramfs.cpio
 cd ..
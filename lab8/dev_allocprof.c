@@ -0,0 +1,44 @@
+#include "include/dev_allocprof.h"
+#include "include/alloc_profile.h"
+#include "include/slab.h"
+#include "include/utils.h"
+#include "include/vfs.h"
+#include "include/vmalloc.h"
+
+extern kmem_cache_t *file_cache;
+
+file_operations_t dev_allocprof_operations = {
+    (void *)op_deny,   dev_allocprof_read, dev_allocprof_open,
+    dev_allocprof_close, (void *)op_deny,  (void *)op_deny};
+
+int init_dev_allocprof() { return register_dev(&dev_allocprof_operations); }
+
+// The report is rendered fresh on every read; f_pos indexes into it.
+int dev_allocprof_read(file_t *file, void *buf, size_t len) {
+  char *report = vmalloc(ALLOC_PROFILE_BUF_SIZE);
+  if (!report) {
+    return -1;
+  }
+  uint32_t total = alloc_profile_render(report, ALLOC_PROFILE_BUF_SIZE);
+  if (file->f_pos >= total) {
+    len = 0;
+  } else if (file->f_pos + len > total) {
+    len = total - file->f_pos;
+  }
+  memcpy(buf, report + file->f_pos, len);
+  file->f_pos += len;
+  vfree(report);
+  return len;
+}
+
+int dev_allocprof_open(vnode_t *file_node, file_t **target) {
+  (*target)->vnode = file_node;
+  (*target)->f_pos = 0;
+  (*target)->f_ops = &dev_allocprof_operations;
+  return 0;
+}
+
+int dev_allocprof_close(file_t *file) {
+  kmem_cache_free(file_cache, file);
+  return 0;
+}
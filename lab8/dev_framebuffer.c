@@ -2,6 +2,7 @@
 #include "include/allocator.h"
 #include "include/exception.h"
 #include "include/mbox.h"
+#include "include/slab.h"
 #include "include/uart.h"
 #include "include/utils.h"
 #include "include/vfs.h"
@@ -9,6 +10,7 @@
 extern volatile unsigned int mbox[];
 extern unsigned int width, height, pitch, isrgb;
 extern void *lfb;
+extern kmem_cache_t *file_cache;
 
 file_operations_t dev_framebuffer_operations = {
     dev_framebuffer_write, (void *)op_deny, dev_framebuffer_open,
@@ -98,6 +100,6 @@ int dev_framebuffer_open(vnode_t *file_node, file_t **target) {
 }
 
 int dev_framebuffer_close(file_t *file) {
-  memory_pool_free(file, 0);
+  kmem_cache_free(file_cache, file);
   return 0;
 }
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include "include/dev_uart.h"
 #include "include/allocator.h"
+#include "include/slab.h"
 #include "include/uart.h"
 #include "include/vfs.h"
 
+extern kmem_cache_t *file_cache;
+
 file_operations_t dev_file_operations = {dev_uart_write,  dev_uart_read,
                                          dev_uart_open,   dev_uart_close,
                                          (void *)op_deny, (void *)op_deny};
@@ -30,6 +33,6 @@ int dev_uart_open(vnode_t *file_node, file_t **target) {
 }
 
 int dev_uart_close(file_t *file) {
-  memory_pool_free(file, 0);
+  kmem_cache_free(file_cache, file);
   return 0;
 }
\ No newline at end of file
@@ -1,8 +1,10 @@
 #include "include/exception.h"
 #include "include/allocator.h"
 #include "include/irq.h"
+#include "include/pagecache.h"
 #include "include/shell.h"
 #include "include/signal.h"
+#include "include/slab.h"
 #include "include/syscall.h"
 #include "include/thread.h"
 #include "include/timer.h"
@@ -13,6 +15,7 @@ extern double_linked_node_t *irq_task_list_head;
 extern double_linked_node_t *timer_list_head;
 extern int current_irq_task_priority;
 extern uint32_t lock_count;
+extern kmem_cache_t *irq_task_cache;
 extern double_linked_node_t *run_queue;
 extern int back_to_shell;
 extern kernel_context_t kernel_context;
@@ -108,7 +111,12 @@ void el0_sync_router(trapframe_t *tpf) {
     sys_ioctl(tpf, tpf->x0, tpf->x1, (void *)tpf->x2);
   } else if (syscall_no == 20) {
     uart_sendline("syscall_no: %d\n", syscall_no);
+    page_cache_sync();
     find_filesystem("fat32fs")->syncfs();
+  } else if (syscall_no == 21) {
+    sys_munmap(tpf, (void *)tpf->x0, tpf->x1);
+  } else if (syscall_no == 22) {
+    sys_msync(tpf, (void *)tpf->x0, tpf->x1, tpf->x2);
   } else if (syscall_no == 50) {
     signal_return(tpf);
   } else if (syscall_no == 87) {
@@ -162,9 +170,9 @@ void irq_task_run_preemptive() {
     ((void (*)(void *))the_task->callback)(the_task->callback_arg);
 
     if (the_task->callback_arg != NULL) {
-      memory_pool_free(the_task->callback_arg, 0);
+      kfree(the_task->callback_arg);
     }
-    memory_pool_free(the_task, 0);
+    kmem_cache_free(irq_task_cache, the_task);
 
     lock();
     current_irq_task_priority = prev_irq_task_priority;
@@ -186,6 +194,7 @@ void unlock() {
 void irq_task_list_init() {
   irq_task_list_head = simple_malloc(sizeof(double_linked_node_t), 0);
   double_linked_init(irq_task_list_head);
+  irq_task_cache = kmem_cache_create("irq_task", sizeof(irq_task_t));
 }
 
 void irq_task_list_insert(irq_task_t *task) {
@@ -204,7 +213,7 @@ void irq_task_list_insert(irq_task_t *task) {
 }
 
 irq_task_t *create_irq_task(void *callback, void *arg, int priority) {
-  irq_task_t *task = memory_pool_allocator(sizeof(irq_task_t), 0);
+  irq_task_t *task = kmem_cache_alloc(irq_task_cache);
   task->callback = callback;
   task->callback_arg = arg;
   task->priority = priority;
@@ -2,7 +2,10 @@
 #include "include/allocator.h"
 #include "include/buddy_system.h"
 #include "include/heap.h"
+#include "include/log.h"
 #include "include/sdhost.h"
+#include "include/shrinker.h"
+#include "include/slab.h"
 #include "include/types.h"
 #include "include/uart.h"
 #include "include/utils.h"
@@ -10,6 +13,9 @@
 
 extern fat32_metadata_t *fat32_md;
 extern double_linked_node_t *fat32_cache_list_head;
+extern kmem_cache_t *fat32_cache_block_cache;
+extern kmem_cache_t *vnode_cache;
+extern kmem_cache_t *file_cache;
 
 file_operations_t fat32_file_operations = {fat32fs_write, fat32fs_read,
                                            fat32fs_open,  fat32fs_close,
@@ -20,12 +26,21 @@ vnode_operations_t fat32_vnode_operations = {fat32fs_lookup, fat32fs_create,
 void fat32fs_cache_init() {
   fat32_cache_list_head = simple_malloc(sizeof(double_linked_node_t), 0);
   double_linked_init(fat32_cache_list_head);
+  fat32_cache_block_cache =
+      kmem_cache_create("fat32_cache_block", sizeof(fat32_cache_block_t));
+  register_shrinker("fat32 block cache", fat32fs_cache_shrink_count,
+                    fat32fs_cache_shrink_scan);
 }
 
 void fat32fs_cache_list_push(uint32_t block_idx, void *buf,
                              uint8_t dirty_flag) {
-  fat32_cache_block_t *node =
-      memory_pool_allocator(sizeof(fat32_cache_block_t), 0);
+  fat32_cache_block_t *node = kmem_cache_alloc(fat32_cache_block_cache);
+  if (!node) {
+    if (dirty_flag) {
+      writeblock(block_idx, buf);
+    }
+    return;
+  }
   node->block_idx = block_idx;
   memcpy((void *)node->block, buf, BLOCK_SIZE);
   node->dirty_flag = dirty_flag;
@@ -168,7 +183,7 @@ int fat32fs_setup_mount(filesystem_t *fs, mount_t *_mount) {
   if (partition1->partition_type == 0x0B) { // FAT32 with CHS addressing
     fat32_bootsector_t fat32_bootsec;
     readblock(partition1->first_sector_lba, (void *)&fat32_bootsec);
-    fat32_md = memory_pool_allocator(sizeof(fat32_metadata_t), 0);
+    fat32_md = kmalloc(sizeof(fat32_metadata_t), GFP_KERNEL);
     fat32_md->fat_region_block_idx =
         partition1->first_sector_lba + fat32_bootsec.n_reserved_sectors;
     fat32_md->data_region_block_idx =
@@ -210,38 +225,76 @@ int fat32fs_setup_mount(filesystem_t *fs, mount_t *_mount) {
   return 0;
 }
 
+static void fat32fs_cache_evict(fat32_cache_block_t *node) {
+  double_linked_remove((double_linked_node_t *)node);
+  if (node->dirty_flag) {
+    writeblock(node->block_idx, (void *)node->block);
+  }
+  kmem_cache_free(fat32_cache_block_cache, node);
+}
+
 int fat32fs_sync() {
-  double_linked_node_t *cur;
-  double_linked_for_each(cur, fat32_cache_list_head) {
+  while (!double_linked_is_empty(fat32_cache_list_head)) {
+    fat32fs_cache_evict((fat32_cache_block_t *)fat32_cache_list_head->next);
+  }
+  return 0;
+}
+
+static uint32_t fat32fs_cache_pages() {
+  kmem_cache_t *cache = fat32_cache_block_cache;
+  uint32_t slabs =
+      cache->partial_count + cache->full_count + cache->empty_count;
+  return slabs * (cache->slab_size / PAGE_SIZE);
+}
+
+// Slabs holding blocks, less those kmem_cache keeps as empty slabs once
+// eviction has drained them.
+uint32_t fat32fs_cache_shrink_count() {
+  kmem_cache_t *cache = fat32_cache_block_cache;
+  uint32_t slabs = cache->partial_count + cache->full_count;
+  if (cache->empty_count < KMEM_CACHE_EMPTY_MAX) {
+    uint32_t kept = KMEM_CACHE_EMPTY_MAX - cache->empty_count;
+    slabs = slabs > kept ? slabs - kept : 0;
+  }
+  return slabs * (cache->slab_size / PAGE_SIZE);
+}
+
+// Drop clean blocks from the cold end of the list until enough slabs have
+// emptied out. Dirty blocks would need SD writes; fat32fs_sync takes those.
+uint32_t fat32fs_cache_shrink_scan(uint32_t nr_pages) {
+  uint32_t before = fat32fs_cache_pages();
+  double_linked_node_t *cur = fat32_cache_list_head->prev;
+  while (cur != fat32_cache_list_head &&
+         before - fat32fs_cache_pages() < nr_pages) {
     fat32_cache_block_t *node = (fat32_cache_block_t *)cur;
-    double_linked_remove((double_linked_node_t *)node);
-    if (node->dirty_flag) {
-      writeblock(node->block_idx, (void *)node->block);
+    cur = cur->prev;
+    if (!node->dirty_flag) {
+      fat32fs_cache_evict(node);
     }
-    memory_pool_free(node, 0);
   }
-  return 0;
+  return before - fat32fs_cache_pages();
 }
 
 vnode_t *fat32fs_create_vnode(mount_t *_mount, node_type_t type,
                               const char *name, uint32_t dirent_cluster,
                               uint32_t first_cluster, uint32_t size) {
-  vnode_t *v = memory_pool_allocator(sizeof(vnode_t), 0);
+  vnode_t *v = kmem_cache_alloc(vnode_cache);
   v->mount = _mount;
   v->v_ops = &fat32_vnode_operations;
   v->f_ops = &fat32_file_operations;
   v->type = FAT32;
-  fat32_inode_t *inode = memory_pool_allocator(sizeof(fat32_inode_t), 0);
+  fat32_inode_t *inode = kmalloc(sizeof(fat32_inode_t), GFP_KERNEL);
   simple_memset(inode, 0, sizeof(fat32_inode_t));
   inode->type = type;
   if (name != NULL) {
-    inode->name = simple_malloc(strlen(name) + 1, 0);
+    inode->name = kmalloc(strlen(name) + 1, GFP_KERNEL);
     strcpy(inode->name, name);
   }
   inode->dirent_cluster = dirent_cluster;
   inode->first_cluster = first_cluster;
   inode->size = size;
   v->internal = inode;
+  v->page_cache = NULL;
   return v;
 }
 
@@ -315,8 +368,8 @@ int fat32fs_write(file_t *file, const void *buf, size_t len) {
     uint32_t available_in_block = BLOCK_SIZE - offset_in_block;
     uint32_t shift =
         (remain_len < available_in_block) ? remain_len : available_in_block;
-    uart_sendline("shift: %d, remain_len: %d, available_in_block: %d\n", shift,
-                  remain_len, available_in_block);
+    log_debug("shift: %d, remain_len: %d, available_in_block: %d\n", shift,
+              remain_len, available_in_block);
     memcpy(ker_buf + offset_in_block, src + (file->f_pos - ori_pos), shift);
     fat32fs_writeblock(fat32fs_clusteridx_2_datablockidx(cluster_idx), ker_buf);
     file->f_pos += shift;
@@ -395,8 +448,8 @@ int fat32fs_read(file_t *file, void *buf, size_t len) {
 }
 
 int fat32fs_open(vnode_t *file_node, file_t **target) {
-  uart_sendline("[fat32fs_open] %s\n",
-                ((fat32_inode_t *)file_node->internal)->name);
+  log_debug("[fat32fs_open] %s\n",
+            ((fat32_inode_t *)file_node->internal)->name);
   (*target)->vnode = file_node;
   (*target)->f_pos = 0;
   (*target)->f_ops = file_node->f_ops;
@@ -404,7 +457,7 @@ int fat32fs_open(vnode_t *file_node, file_t **target) {
 }
 
 int fat32fs_close(file_t *file) {
-  memory_pool_free(file, 0);
+  kmem_cache_free(file_cache, file);
   return 0;
 }
 
@@ -438,7 +491,7 @@ int fat32fs_lookup(vnode_t *dir_node, vnode_t **target,
 
 int fat32fs_create(vnode_t *dir_node, vnode_t **target,
                    const char *component_name) {
-  uart_sendline("[fat32fs_create] Creating file: %s\n", component_name);
+  log_info("[fat32fs_create] Creating file: %s\n", component_name);
 
   fat32_inode_t *dir_inode = dir_node->internal;
   if (dir_inode->type != DIR) {
@@ -514,7 +567,7 @@ int fat32fs_create(vnode_t *dir_node, vnode_t **target,
 
 int fat32fs_mkdir(vnode_t *dir_node, vnode_t **target,
                   const char *component_name) {
-  uart_sendline("[fat32fs_mkdir] Creating directory: %s\n", component_name);
+  log_info("[fat32fs_mkdir] Creating directory: %s\n", component_name);
 
   fat32_inode_t *dir_inode = dir_node->internal;
   if (dir_inode->type != DIR) {
@@ -1,3 +1,4 @@
+#include "include/alloc_profile.h"
 #include "include/allocator.h"
 #include "include/buddy_system.h"
 #include "include/cpio.h"
@@ -5,7 +6,11 @@
 #include "include/exception.h"
 #include "include/fat32.h"
 #include "include/heap.h"
+#include "include/log.h"
+#include "include/mmu.h"
 #include "include/shell.h"
+#include "include/shrinker.h"
+#include "include/slab.h"
 #include "include/thread.h"
 #include "include/types.h"
 #include "include/uart.h"
@@ -32,6 +37,7 @@ char *dtb_ptr = NULL;
 
 // heap.c
 char *heap_ptr = NULL;
+char *heap_end = NULL;
 startup_memory_block_t *startup_memory_block_table_start = NULL;
 startup_memory_block_t *startup_memory_block_table_end = NULL;
 
@@ -41,29 +47,81 @@ circular_buffer_t tx_buffer = {.head = 0, .tail = 0},
 
 // timer.c
 double_linked_node_t *timer_list_head = NULL;
+kmem_cache_t *timer_task_cache = NULL;
 
 // exception.c
 double_linked_node_t *irq_task_list_head = NULL;
 int current_irq_task_priority = 999;
 uint32_t lock_count = 0;
+kmem_cache_t *irq_task_cache = NULL;
 
 // buddy_system.c
 buddy_system_node_t buddy_system[MAX_LEVEL + 1];
+uint64_t buddy_system_free_levels = 0; // bit n set: level n freelist non-empty
+uint64_t buddy_system_type_levels[MIGRATE_TYPES]; // the same, per type
+uint8_t buddy_system_pageblock_type[PAGEBLOCK_COUNT];
+int (*buddy_system_migrate)(uint64_t from, uint64_t to) = NULL;
+uint64_t buddy_system_free_pages = 0;
+buddy_system_stats_t buddy_system_stats;
+buddy_system_magazine_t buddy_system_magazines[MAGAZINE_LEVELS];
+buddy_system_zero_pool_t buddy_system_zero_pool;
 frame_array_node_t frame_array[TOTAL_MEMORY / PAGE_SIZE];
 
+// log.c
+log_ring_t log_ring;
+int log_console_level = LOG_INFO;
+
+// alloc_trace.h
+int alloc_trace_depth = 0;
+
+// alloc_profile.c
+#ifdef ALLOC_PROFILE
+int alloc_profile_depth = 0;
+alloc_site_t alloc_sites[ALLOC_PROFILE_SITES];
+#endif
+
+// vmalloc.c
+double_linked_node_t vmap_area_list;
+kmem_cache_t *vmap_area_cache = NULL;
+uint64_t vmalloc_pages = 0;
+
+// slab.c
+kmem_cache_t kmem_caches[KMEM_CACHE_MAX];
+uint32_t kmem_cache_count = 0;
+
+// shrinker.c
+shrinker_t shrinkers[MAX_SHRINKER_REG];
+int shrinking = 0;
+
 // allocator.c
-double_linked_node_t pools[SMALL_SIZES_COUNT];
+kmem_cache_t *pools[SMALL_SIZES_COUNT];
 const uint32_t SMALL_SIZES[SMALL_SIZES_COUNT] = {32, 64, 128, 256, 512, 1024};
+kmem_cache_t *large_pools[LARGE_SIZES_COUNT];
+const uint32_t LARGE_SIZES[LARGE_SIZES_COUNT] = {0x800, 0x1000, 0x2000, 0x4000};
 
 // thread.c
 thread_t *current_thread = NULL;
 double_linked_node_t *run_queue = NULL;
 thread_t thread_table[PID_MAX + 1];
+kmem_cache_t *vma_cache = NULL;
+char *thread_stack_cache[THREAD_STACK_CACHE_MAX];
+uint32_t thread_stack_cache_count = 0;
+
+// mmu.c
+uint64_t asid_generation = 1UL << ASID_BITS;
+uint64_t asid_next = 1;
+uint64_t asid_rollovers = 0;
+uint64_t asid_reserved_ttbr0 = MMU_PGD_BASE;
 
 // vfs.c
 mount_t *rootfs = NULL;
 filesystem_t reg_fs[MAX_FS_REG];
 file_operations_t reg_dev[MAX_DEV_REG];
+kmem_cache_t *vnode_cache = NULL;
+kmem_cache_t *file_cache = NULL;
+
+// pagecache.c
+double_linked_node_t *page_cache_list = NULL;
 
 // dev_framebuffer.c
 unsigned int width, height, pitch, isrgb;
@@ -77,4 +135,8 @@ int is_hcs;
 
 // fat32.c
 fat32_metadata_t *fat32_md = NULL;
-double_linked_node_t *fat32_cache_list_head = NULL;
\ No newline at end of file
+double_linked_node_t *fat32_cache_list_head = NULL;
+kmem_cache_t *fat32_cache_block_cache = NULL;
+
+// tmpfs.c
+kmem_cache_t *tmpfs_inode_cache = NULL;
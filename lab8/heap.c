@@ -1,11 +1,14 @@
 #include "include/heap.h"
+#include "include/buddy_system.h"
 #include "include/cpio.h"
 #include "include/dtb.h"
 #include "include/types.h"
 #include "include/uart.h"
+#include "include/utils.h"
 
 extern char _heap_top;
 extern char *heap_ptr;
+extern char *heap_end;
 extern char _start;
 extern char _end;
 extern cpio_newc_header_t *cpio_header;
@@ -15,6 +18,7 @@ extern startup_memory_block_t *startup_memory_block_table_end;
 
 void heap_init() {
   heap_ptr = &_heap_top;
+  heap_end = &_end - BOOT_STACK_SIZE;
   uart_sendline("Heap pointer start at address: 0x%p.\n",
                 (unsigned long)heap_ptr);
 }
@@ -22,7 +26,7 @@ void heap_init() {
 void *simple_malloc(unsigned int size, int show_info) {
   unsigned int alignment = 8;
   size = align_size(size, alignment);
-  if (heap_ptr + size > &_end) {
+  if (heap_ptr + size > heap_end) {
     uart_sendline("[Simple Malloc Error] Out of memory.\n");
     return NULL;
   }
@@ -36,11 +40,19 @@ void *simple_malloc(unsigned int size, int show_info) {
   return allocated_memory;
 }
 
+// Hand what is left of the boot heap to the buddy system. The shell keeps
+// running on the boot stack, so its top BOOT_STACK_SIZE bytes stay reserved.
+void heap_release() {
+  uint64_t start = VIRT_TO_PHYS((uint64_t)heap_ptr);
+  uint64_t end = VIRT_TO_PHYS((uint64_t)heap_end);
+  uart_sendline("Releasing boot heap from 0x%p to 0x%p.\n",
+                (unsigned long)heap_ptr, (unsigned long)heap_end);
+  heap_end = heap_ptr;
+  buddy_system_free_range(start, end);
+}
+
 void simple_memset(void *ptr, int value, unsigned int num) {
-  unsigned char *p = ptr;
-  while (num--) {
-    *p++ = (unsigned char)value;
-  }
+  memset(ptr, value, num);
 }
 
 unsigned int align_size(unsigned int size, unsigned int alignment) {
@@ -0,0 +1,61 @@
+#ifndef ALLOC_PROFILE_H
+#define ALLOC_PROFILE_H
+
+#include "types.h"
+
+/*
+ * Allocation-site profiling, built in with `make ALLOC_PROFILE=1`. Every live
+ * allocation carries the id of the call site that made it: buddy blocks in
+ * the cache field of their head frame descriptor, slab objects in a tag
+ * behind the object. Each site keeps its live bytes and counts, listed by
+ * the allocprof shell command and /dev/allocprof; tools/allocprof.sh
+ * resolves the addresses against build/kernel8.elf.
+ *
+ * Only the outermost allocator call records, so kmalloc objects are charged
+ * to kmalloc's caller and the pages under a slab to nobody.
+ */
+#define ALLOC_PROFILE_BUF_SIZE 0x2000
+
+#ifdef ALLOC_PROFILE
+#define ALLOC_PROFILE_SITES 512 // site 0 collects callers that do not fit
+#define ALLOC_PROFILE_TAG_SIZE 8
+
+typedef struct alloc_site {
+  uint64_t caller; // return address of the allocator call
+  uint64_t live_bytes;
+  uint64_t allocs;
+  uint32_t live_count;
+} alloc_site_t;
+
+typedef struct alloc_profile_tag {
+  uint32_t size;
+  uint16_t site;
+  uint16_t valid;
+} alloc_profile_tag_t;
+
+extern int alloc_profile_depth;
+
+#define alloc_profile_caller() ((uint64_t)__builtin_return_address(0))
+#define alloc_profile_enter() (alloc_profile_depth++)
+#define alloc_profile_exit() (alloc_profile_depth--)
+// A fresh slab object carries no site until it is tagged.
+#define alloc_profile_clear(object, object_size)                              \
+  (((alloc_profile_tag_t *)((char *)(object) + (object_size) -                 \
+                            ALLOC_PROFILE_TAG_SIZE))                           \
+       ->valid = 0)
+void alloc_profile_tag(void *ptr, uint32_t size, uint64_t caller);
+void alloc_profile_untag(void *ptr);
+#else
+#define ALLOC_PROFILE_TAG_SIZE 0
+#define alloc_profile_caller() 0
+#define alloc_profile_enter()
+#define alloc_profile_exit()
+#define alloc_profile_clear(object, object_size)
+#define alloc_profile_tag(ptr, size, caller)
+#define alloc_profile_untag(ptr)
+#endif
+
+uint32_t alloc_profile_render(char *buf, uint32_t size);
+void alloc_profile_print();
+
+#endif /* ALLOC_PROFILE_H */
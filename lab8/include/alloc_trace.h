@@ -0,0 +1,34 @@
+#ifndef ALLOC_TRACE_H
+#define ALLOC_TRACE_H
+
+/*
+ * Allocation trace points, built in with `make ALLOC_TRACE=1`. Every record
+ * is one UART line that tools/allocbench can replay on the host:
+ *
+ *   [Trace] P <size> <addr>            buddy_system_allocator
+ *   [Trace] p <addr>                   buddy_system_free
+ *   [Trace] S <cache> <size> <addr>    kmem_cache_alloc
+ *   [Trace] s <cache> <addr>           kmem_cache_free
+ *
+ * Page operations made by the slab layer itself are not recorded; replaying
+ * the object operation reproduces them.
+ */
+#ifdef ALLOC_TRACE
+#include "uart.h"
+
+extern int alloc_trace_depth;
+
+#define alloc_trace_enter() (alloc_trace_depth++)
+#define alloc_trace_exit() (alloc_trace_depth--)
+#define alloc_trace(...)                                                       \
+  do {                                                                         \
+    if (!alloc_trace_depth)                                                    \
+      uart_sendline("[Trace] " __VA_ARGS__);                                   \
+  } while (0)
+#else
+#define alloc_trace_enter()
+#define alloc_trace_exit()
+#define alloc_trace(...)
+#endif
+
+#endif /* ALLOC_TRACE_H */
@@ -6,10 +6,19 @@
 
 #define SMALL_SIZES_COUNT 6
 #define SMALLEST_SIZE 32
+#define LARGE_SIZES_COUNT 4 // page-multiple slabs, 2 KB .. 16 KB
+
+#define __GFP_MOVABLE 0x1 // user page, may be migrated by compaction
+#define __GFP_ZERO 0x2    // zero filled, single pages from the zero pool
+
+#define GFP_KERNEL 0x0
+#define GFP_USER (__GFP_MOVABLE)
 
 void memory_pool_init();
 int memory_pool_find_pool_index(uint32_t size);
 void *memory_pool_allocator(uint32_t size, int show_info);
 void memory_pool_free(void *address, int show_info);
+void *kmalloc(uint32_t size, uint32_t flags);
+void kfree(void *ptr);
 
 #endif /* ALLOCATOR_H */
\ No newline at end of file
@@ -1,42 +1,137 @@
 #ifndef BUDDY_SYSTEM_H
 #define BUDDY_SYSTEM_H
 
-#include "dlist.h"
 #include "mmu.h"
 #include "types.h"
 
+#ifndef BUDDY_MEMORY_BASE // the host benchmark points this at its own arena
 #define BUDDY_MEMORY_BASE PHYS_TO_VIRT(0x0)
+#endif
 #define PAGE_SIZE 0x1000 // 4KB
+#define PAGE_SHIFT 12
 #define MAX_LEVEL 14
 #define TOTAL_MEMORY 0x3C000000
 // #define MAX_LEVEL 10
 // #define TOTAL_MEMORY 0x3B400000
 
+#define FRAME_NONE 0xFFFFFFFF // end of a frame list
+
+#define FRAME_ALLOCATED 0x1 // first frame of an allocated block
+#define FRAME_SLAB 0x2      // block is carved into kmem_cache objects
+#define FRAME_MOVABLE 0x4   // user page that compaction may migrate
+#define FRAME_ISOLATED 0x8  // held by the compactor until it is done
+#define FRAME_PROFILED 0x10 // allocation site id kept in cache
+#define FRAME_CACHED 0x20   // free, parked in a magazine or the zero pool
+
+// Free memory is grouped by mobility in 2MB pageblocks, so user pages that
+// compaction can move do not end up scattered between pinned kernel pages.
+// A free block sits on the list of its first pageblock's type.
+#define PAGEBLOCK_ORDER 9
+#define PAGEBLOCK_COUNT (TOTAL_MEMORY >> (PAGE_SHIFT + PAGEBLOCK_ORDER))
+#define MIGRATE_UNMOVABLE 0
+#define MIGRATE_MOVABLE 1
+
+// A huge page is one pageblock, mapped by a single level 2 block entry.
+#define HUGE_PAGE_ORDER PAGEBLOCK_ORDER
+#define HUGE_PAGE_SIZE (PAGE_SIZE << HUGE_PAGE_ORDER)
+#define MIGRATE_TYPES 2
+
 typedef struct buddy_system_node {
-  char *bitmap;
-  double_linked_node_t head;
+  uint64_t *bitmap;             // one bit per block of this level, 64 per word
+  uint32_t head[MIGRATE_TYPES]; // first free block's frame index, per type
+  uint32_t count;               // free blocks on this level
 } buddy_system_node_t;
 
+// 16 bytes per 4KB frame. Lists link frame indices rather than pointers, and
+// a slab keeps its free objects inside its own pages, so only the cache id
+// and the offset of the first free object live here.
 typedef struct frame_array_node {
-  double_linked_node_t node;
-  uint32_t size;
-  uint32_t index;
-  char *slot_bitmap;
-  uint32_t slot_size;
-  uint32_t slot_count;
-  uint32_t ref;
+  uint32_t next;
+  uint32_t prev;
+  uint8_t order; // block level, valid on the first frame of a block
+  uint8_t flags;
+  uint16_t ref;      // user mappings; objects in use when FRAME_SLAB is set
+  uint16_t cache;    // kmem_cache id when FRAME_SLAB is set, else site id
+  uint16_t freelist; // offset of the first free object in the slab
 } frame_array_node_t;
 
+// Per-order cache of free blocks in front of the buddy lists. Allocation and
+// free of order 0 and 1 blocks only touch the magazine; it is refilled up to
+// `low` in one batch when empty and drained back down to `low` when it
+// reaches `high`.
+#define MAGAZINE_LEVELS 2
+#define MAGAZINE_CAPACITY 256
+#define MAGAZINE_DEFAULT_LOW 64
+#define MAGAZINE_DEFAULT_HIGH 192
+
+typedef struct buddy_system_magazine {
+  uint32_t count;
+  uint32_t low;
+  uint32_t high;
+  uint32_t blocks[MAGAZINE_CAPACITY]; // first frame index of cached blocks
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t refills;
+  uint64_t drains;
+} buddy_system_magazine_t;
+
+// Pre-zeroed single pages for __GFP_ZERO requests, topped up by the idle
+// thread so page tables and PGDs are not cleared on the fault and fork path.
+#define ZERO_POOL_CAPACITY 256
+#define ZERO_POOL_DEFAULT_TARGET 128
+#define ZERO_POOL_FILL_BATCH 8 // pages zeroed per idle pass
+
+typedef struct buddy_system_zero_pool {
+  uint32_t count;
+  uint32_t target;
+  uint32_t pages[ZERO_POOL_CAPACITY]; // frame indices, already zeroed
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t filled;
+} buddy_system_zero_pool_t;
+
+typedef struct buddy_system_stats {
+  uint64_t alloc_count;
+  uint64_t alloc_ticks;
+  uint64_t alloc_max_ticks;
+  uint64_t free_count;
+  uint64_t free_ticks;
+  uint64_t free_max_ticks;
+  uint64_t order_allocs[MAX_LEVEL + 1];
+  uint64_t order_frees[MAX_LEVEL + 1];
+  uint64_t splits;
+  uint64_t merges;
+  uint64_t failures;
+  uint64_t steals;    // pageblocks handed to the other mobility type
+  uint64_t fallbacks; // blocks borrowed without taking their pageblock
+  uint64_t compact_runs;
+  uint64_t compact_success;
+  uint64_t compact_migrated;
+  uint64_t compact_ticks;
+} buddy_system_stats_t;
+
 void buddy_system_init();
 uint32_t buddy_system_find_level(uint32_t size);
 uint32_t size_to_power_of_two(uint32_t size);
 uint64_t buddy_system_allocator(uint32_t size);
 void buddy_system_free(uint64_t address);
+uint32_t alloc_pages_bulk(uint32_t nr_pages, uint64_t *pages,
+                          uint32_t flags);
+void free_pages_bulk(uint32_t nr_pages, uint64_t *pages);
+uint64_t alloc_huge_page();
+void buddy_system_zero_pool_fill(uint32_t budget);
+void frame_ref_range(uint64_t phys_addr, uint32_t nr_pages, int delta);
+void buddy_system_free_range(uint64_t start, uint64_t end);
+void frame_list_add(uint32_t *head, uint32_t index);
+void frame_list_remove(uint32_t *head, uint32_t index);
+void buddy_system_register_migrate(int (*migrate)(uint64_t from,
+                                                  uint64_t to));
+int buddy_system_compact(uint32_t level);
+int buddy_system_magazine_set_watermark(uint32_t level, uint32_t low,
+                                        uint32_t high);
 void buddy_system_print_bitmap();
 void buddy_system_print_freelists(int show_bitmap);
-void buddy_system_reserve_memory(uint64_t start, uint64_t end);
-void buddy_system_reserve_memory_init();
-void buddy_system_merge_bottom_up();
 void buddy_system_freelists_init();
+void buddy_system_print_stats();
 
 #endif /* BUDDY_SYSTEM_H */
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "types.h"
+
+// ctr_el0: DminLine[19:16] and IminLine[3:0] are log2 of the number of words
+// in the smallest data / instruction cache line.
+#define CTR_DMINLINE(ctr) (4 << (((ctr) >> 16) & 0xF))
+
+void cache_clean_range(void *start, size_t size);
+void cache_invalidate_range(void *start, size_t size);
+void cache_clean_invalidate_range(void *start, size_t size);
+void cache_sync_icache_range(void *start, size_t size);
+
+#endif /* CACHE_H */
@@ -0,0 +1,13 @@
+#ifndef DEV_ALLOCPROF_H
+#define DEV_ALLOCPROF_H
+
+#include "types.h"
+#include "vfs.h"
+
+int init_dev_allocprof();
+
+int dev_allocprof_read(file_t *file, void *buf, size_t len);
+int dev_allocprof_open(vnode_t *file_node, file_t **target);
+int dev_allocprof_close(file_t *file);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef DEV_MEMINFO_H
+#define DEV_MEMINFO_H
+
+#include "types.h"
+#include "vfs.h"
+
+int init_dev_meminfo();
+
+int dev_meminfo_read(file_t *file, void *buf, size_t len);
+int dev_meminfo_open(vnode_t *file_node, file_t **target);
+int dev_meminfo_close(file_t *file);
+
+#endif
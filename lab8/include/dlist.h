@@ -110,4 +110,14 @@ double_linked_is_empty(const struct double_linked_node *head) {
 #define double_linked_for_each(cur, head)                                      \
   for (cur = (head)->next; !double_linked_is_head(cur, (head)); cur = cur->next)
 
+/**
+ * double_linked_for_each_safe - iterate over a list, safe against removal
+ * @cur: the &struct double_linked_node to use as a loop cursor.
+ * @n: another &struct double_linked_node to use as temporary storage.
+ * @head: the head for your list.
+ */
+#define double_linked_for_each_safe(cur, n, head)                              \
+  for (cur = (head)->next, n = cur->next; !double_linked_is_head(cur, (head)); \
+       cur = n, n = cur->next)
+
 #endif /* DLIST_H */
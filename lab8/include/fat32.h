@@ -144,6 +144,8 @@ void fat32fs_fill_SFN_fname(fat32_dirent_sfn_t *dirent, const char *filename);
 int register_fat32fs();
 int fat32fs_setup_mount(filesystem_t *fs, mount_t *_mount);
 int fat32fs_sync();
+uint32_t fat32fs_cache_shrink_count();
+uint32_t fat32fs_cache_shrink_scan(uint32_t nr_pages);
 vnode_t *fat32fs_create_vnode(mount_t *_mount, node_type_t type,
                               const char *name, uint32_t dirent_cluster,
                               uint32_t first_cluster, uint32_t size);
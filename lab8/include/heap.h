@@ -1,6 +1,8 @@
 #ifndef HEAP_H
 #define HEAP_H
 
+#define BOOT_STACK_SIZE 0x10000 // top of the heap region, kept after release
+
 typedef struct startup_memory_block {
   struct startup_memory_block *next;
   unsigned long address;
@@ -9,6 +11,7 @@ typedef struct startup_memory_block {
 
 void heap_init();
 void *simple_malloc(unsigned int size, int show_info);
+void heap_release();
 void simple_memset(void *ptr, int value, unsigned int num);
 unsigned int align_size(unsigned int size, unsigned int alignment);
 void startup_memory_block_table_add(unsigned long start, unsigned long end);
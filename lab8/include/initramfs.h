@@ -24,6 +24,7 @@ int initramfs_read(file_t *file, void *buf, size_t len);
 int initramfs_open(vnode_t *file_node, file_t **target);
 int initramfs_close(file_t *file);
 long initramfs_getsize(vnode_t *vd);
+uint64_t initramfs_map_page(vnode_t *vd, size_t offset);
 
 int initramfs_lookup(vnode_t *dir_node, vnode_t **target,
                      const char *component_name);
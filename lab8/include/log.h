@@ -0,0 +1,55 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "types.h"
+
+/*
+ * Leveled kernel log. A message is formatted once into the log ring as a
+ * line tagged "<level>"; the UART transmit interrupt copies the lines at or
+ * below the console level out to the UART in the background, and `dmesg`
+ * replays what the ring still holds. Writers reserve ring space with an
+ * atomic add and never take a lock, so logging is safe from fault and IRQ
+ * context. When the ring wraps, the oldest lines are overwritten.
+ *
+ * Messages above LOG_LEVEL are compiled out; build with `make LOG_LEVEL=3`
+ * to keep the debug ones. The console level is set at run time with the
+ * loglevel shell command.
+ */
+#define LOG_ERR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+#define LOG_RING_SIZE 0x4000 // power of two
+#define LOG_LINE_MAX 256
+
+typedef struct log_ring {
+  char buf[LOG_RING_SIZE];
+  uint64_t head;      // bytes reserved by writers
+  uint64_t committed; // bytes written; equals head when nobody is writing
+  uint64_t published; // every byte below this is complete
+  uint64_t console;   // next byte for the UART
+  uint64_t dropped;   // bytes overwritten before the UART got to them
+  int console_skip; // the line being sent is above the console level
+} log_ring_t;
+
+#define log_printf(level, ...)                                                 \
+  do {                                                                         \
+    if ((level) <= LOG_LEVEL)                                                  \
+      klog((level), __VA_ARGS__);                                              \
+  } while (0)
+#define log_err(...) log_printf(LOG_ERR, __VA_ARGS__)
+#define log_warn(...) log_printf(LOG_WARN, __VA_ARGS__)
+#define log_info(...) log_printf(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) log_printf(LOG_DEBUG, __VA_ARGS__)
+
+void klog(int level, const char *fmt, ...);
+int log_console_drain();
+void log_set_console_level(int level);
+void log_dmesg();
+
+#endif /* LOG_H */
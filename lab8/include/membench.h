@@ -0,0 +1,10 @@
+#ifndef MEMBENCH_H
+#define MEMBENCH_H
+
+#define MEMBENCH_MIN_SIZE 64
+#define MEMBENCH_MAX_SIZE 0x10000
+#define MEMBENCH_BYTES 0x100000 // moved per measurement, whatever the size
+
+void membench_run();
+
+#endif /* MEMBENCH_H */
@@ -0,0 +1,14 @@
+#ifndef MEMINFO_H
+#define MEMINFO_H
+
+#include "types.h"
+
+#define MEMINFO_BUF_SIZE 0x2000
+
+uint32_t meminfo_append(char *buf, uint32_t size, uint32_t len,
+                        const char *fmt, ...);
+uint32_t meminfo_fragmentation(uint32_t order);
+uint32_t meminfo_render(char *buf, uint32_t size);
+void meminfo_print();
+
+#endif /* MEMINFO_H */
@@ -4,6 +4,7 @@
 #include "dlist.h"
 #include "thread.h"
 #include "types.h"
+#include "vma.h"
 
 // tcr_el1: The control register for stage 1 of the EL1&0 translation regime.
 // T0SZ[5:0]   The size offset for ttbr0_el1 is 2**(64-T0SZ):
@@ -14,19 +15,40 @@
 // TG0[15:14]  Granule size for the TTBR0_EL1: 0b00 = 4KB
 // TG1[31:30]  Granule size for the TTBR1_EL1: 0b10 = 4KB
 #define TCR_CONFIG_4KB ((0b00 << 14) | (0b10 << 30))
-#define TCR_CONFIG_DEFAULT (TCR_CONFIG_REGION_48bit | TCR_CONFIG_4KB)
+// IRGN0[9:8] ORGN0[11:10] IRGN1[25:24] ORGN1[27:26]: 0b01 = table walks are
+// Write-Back Read-Allocate Write-Allocate Cacheable
+// SH0[13:12]  SH1[29:28]: 0b11 = Inner Shareable
+#define TCR_CONFIG_WALK_CACHE                                                  \
+  ((0b01 << 8) | (0b01 << 10) | (0b11 << 12) | (0b01 << 24) | (0b01 << 26) |   \
+   (0b11 << 28))
+#define TCR_CONFIG_DEFAULT                                                     \
+  (TCR_CONFIG_REGION_48bit | TCR_CONFIG_4KB | TCR_CONFIG_WALK_CACHE)
 
-// ((MAIR_DEVICE_nGnRnE << (MAIR_IDX_DEVICE_nGnRnE * 8)) |
-// (MAIR_NORMAL_NOCACHE << (MAIR_IDX_NORMAL_NOCACHE * 8)))
 // mair_el1: Provides the memory attribute encodings corresponding
 // to the possible AttrIndx values for stage 1 translations at EL1.
 // ATTR0[7:0]: 0b0000dd00 Device memory,   dd = 0b00   Device-nGnRnE memory
 // ATTR1[14:8] 0booooiiii Normal memory, oooo = 0b0100 Outer Non-cacheable,
 // iiii = 0b0100 Inner Non-cacheable
+// ATTR2[23:16] 0booooiiii Normal memory, oooo = 0b1111 Outer Write-Back
+// Read/Write-Allocate, iiii = 0b1111 Inner Write-Back Read/Write-Allocate
 #define MAIR_DEVICE_nGnRnE 0b00000000
 #define MAIR_NORMAL_NOCACHE 0b01000100
+#define MAIR_NORMAL_CACHE 0b11111111
 #define MAIR_IDX_DEVICE_nGnRnE 0
 #define MAIR_IDX_NORMAL_NOCACHE 1
+#define MAIR_IDX_NORMAL_CACHE 2
+#define MAIR_CONFIG_DEFAULT                                                    \
+  ((MAIR_DEVICE_nGnRnE << (MAIR_IDX_DEVICE_nGnRnE * 8)) |                      \
+   (MAIR_NORMAL_NOCACHE << (MAIR_IDX_NORMAL_NOCACHE * 8)) |                    \
+   (MAIR_NORMAL_CACHE << (MAIR_IDX_NORMAL_CACHE * 8)))
+
+// sctlr_el1: M[0] MMU enable, C[2] data cache enable, I[12] instruction cache
+// enable
+#define SCTLR_MMU_ENABLED (1 << 0)
+#define SCTLR_DCACHE_ENABLED (1 << 2)
+#define SCTLR_ICACHE_ENABLED (1 << 12)
+#define SCTLR_CONFIG_DEFAULT                                                   \
+  (SCTLR_MMU_ENABLED | SCTLR_DCACHE_ENABLED | SCTLR_ICACHE_ENABLED)
 
 #define PD_TABLE 0b11L       // Table Entry Armv8_a_address_translation p.14
 #define PD_BLOCK 0b01L       // Block Entry
@@ -36,6 +58,8 @@
 #define PD_RDONLY (1L << 7)  // 0 for read-write, 1 for read-only.
 #define PD_UK_ACCESS                                                           \
   (1L << 6) // 0 for only kernel access, 1 for user/kernel access.
+#define PD_INNER_SHARE (0b11L << 8) // SH[9:8] 0b11 for Inner Shareable
+#define PD_NG (1L << 11) // not global: the TLB entry is tagged with the ASID
 
 // Used for EL1
 #define BOOT_PGD_ATTR (PD_TABLE)
@@ -46,6 +70,8 @@
    (MAIR_IDX_DEVICE_nGnRnE << 2) | PD_BLOCK)
 #define BOOT_PTE_ATTR_NOCACHE                                                  \
   (PD_ACCESS | (MAIR_IDX_NORMAL_NOCACHE << 2) | PD_BLOCK)
+#define BOOT_PTE_ATTR_CACHE                                                    \
+  (PD_ACCESS | PD_INNER_SHARE | (MAIR_IDX_NORMAL_CACHE << 2) | PD_BLOCK)
 
 #define MMU_PGD_BASE 0x2000L
 #define MMU_PGD_ADDR (MMU_PGD_BASE + 0x0000L)
@@ -61,23 +87,25 @@
 #define USER_SPACE 0x0L
 #define USER_STACK_BASE 0xfffffffff000L
 #define USER_SIGNAL_WRAPPER_VA 0xfffffff00000L
+#define USER_SPACE_END 0x1000000000000L // ttbr0_el1 covers 48 bits
+#define MMU_FREE_BATCH 64 // pages handed to free_pages_bulk at once
 
-typedef struct vm_area_struct {
-  double_linked_node_t node;
-  uint64_t virt_addr;
-  uint64_t phys_addr;
-  uint64_t area_size;
-  uint64_t rwx; // 1, 2, 4
-  int is_alloced;
-} vm_area_struct_t;
+// ttbr0_el1 ASID[63:48]; TCR_EL1.AS is 0, so only the low 8 bits are used.
+// ASID 0 is never handed out: it tags the boot tables and the rollover.
+#define ASID_BITS 8
+#define ASID_MASK ((1UL << ASID_BITS) - 1)
+#define TTBR_ASID_SHIFT 48
+#define TTBR_BADDR_MASK 0xffffffffffffUL
 
 #define MEMFAIL_DATA_ABORT_LOWER 0b100100 // esr_el1
 #define MEMFAIL_INST_ABORT_LOWER 0b100000 // EC, bits [31:26]
+#define MEMFAIL_DATA_ABORT_SAME 0b100101  // from EL1, e.g. copying to user
 
 #define TF_LEVEL0 0b000100 // iss IFSC, bits [5:0]
 #define TF_LEVEL1 0b000101
 #define TF_LEVEL2 0b000110
 #define TF_LEVEL3 0b000111
+#define ISS_WNR (1 << 6) // data abort caused by a write
 
 typedef struct {
   uint32_t iss : 25, // Instruction specific syndrome
@@ -86,11 +114,32 @@ typedef struct {
 } esr_el1_t;
 
 void *set_2M_kernel_mmu(void *x0);
-void map_one_page(size_t *virt_pgd_p, size_t va, size_t pa, size_t flag);
-void mmu_add_vma(thread_t *t, size_t va, size_t size, size_t pa, size_t rwx,
-                 int is_alloced);
+size_t mmu_memory_attr(size_t pa);
+int map_one_page(size_t *virt_pgd_p, size_t va, size_t pa, size_t flag);
+int map_huge_page(size_t *virt_pgd_p, size_t va, size_t pa, size_t flag);
+size_t *mmu_find_pmd(size_t *virt_pgd_p, size_t va);
+size_t *mmu_find_pte(size_t *virt_pgd_p, size_t va);
+vm_area_struct_t *mmu_add_vma(thread_t *t, size_t va, size_t size, size_t pa,
+                              size_t rwx, int is_alloced);
+int mmu_add_vma_pages(thread_t *t, size_t va, uint64_t *pages,
+                      uint32_t nr_pages, size_t rwx);
+int mmu_dup_vma(thread_t *t, vm_area_struct_t *vma);
+uint64_t mmu_vma_phys(vm_area_struct_t *vma, size_t offset);
+int mmu_map_area(size_t *virt_pgd_p, vm_area_struct_t *vma, size_t flag);
+int mmu_fork_range(size_t *from_pgd, size_t *to_pgd, size_t va, size_t size,
+                   size_t wrprotect);
+int mmu_map_anon(thread_t *t, size_t va, size_t len, size_t rwx);
+int mmu_map_file(thread_t *t, size_t va, size_t len, size_t rwx,
+                 vnode_t *vnode, size_t offset, int map_shared);
+int mmu_unmap(thread_t *t, size_t va, size_t len);
+void mmu_wrprotect_page(uint64_t pa);
 void mmu_del_vma(thread_t *t);
+vm_area_struct_t *mmu_find_vma(thread_t *t, size_t va);
+int mmu_migrate_page(uint64_t from, uint64_t to);
 void mmu_free_page_tables(size_t *page_table, int level);
 void mmu_memfail_abort_handler(esr_el1_t *esr_el1);
+void mmu_asid_init(void *empty_pgd);
+uint64_t mmu_asid(uint64_t *asid);
+uint64_t mmu_ttbr0(thread_t *t);
 
 #endif /* MMU_H */
\ No newline at end of file
@@ -12,19 +12,40 @@
 // TG0[15:14]  Granule size for the TTBR0_EL1: 0b00 = 4KB
 // TG1[31:30]  Granule size for the TTBR1_EL1: 0b10 = 4KB
 #define TCR_CONFIG_4KB ((0b00 << 14) | (0b10 << 30))
-#define TCR_CONFIG_DEFAULT (TCR_CONFIG_REGION_48bit | TCR_CONFIG_4KB)
+// IRGN0[9:8] ORGN0[11:10] IRGN1[25:24] ORGN1[27:26]: 0b01 = table walks are
+// Write-Back Read-Allocate Write-Allocate Cacheable
+// SH0[13:12]  SH1[29:28]: 0b11 = Inner Shareable
+#define TCR_CONFIG_WALK_CACHE                                                  \
+  ((0b01 << 8) | (0b01 << 10) | (0b11 << 12) | (0b01 << 24) | (0b01 << 26) |   \
+   (0b11 << 28))
+#define TCR_CONFIG_DEFAULT                                                     \
+  (TCR_CONFIG_REGION_48bit | TCR_CONFIG_4KB | TCR_CONFIG_WALK_CACHE)
 
-// ((MAIR_DEVICE_nGnRnE << (MAIR_IDX_DEVICE_nGnRnE * 8)) |
-// (MAIR_NORMAL_NOCACHE << (MAIR_IDX_NORMAL_NOCACHE * 8)))
 // mair_el1: Provides the memory attribute encodings corresponding
 // to the possible AttrIndx values for stage 1 translations at EL1.
 // ATTR0[7:0]: 0b0000dd00 Device memory,   dd = 0b00   Device-nGnRnE memory
 // ATTR1[14:8] 0booooiiii Normal memory, oooo = 0b0100 Outer Non-cacheable,
 // iiii = 0b0100 Inner Non-cacheable
+// ATTR2[23:16] 0booooiiii Normal memory, oooo = 0b1111 Outer Write-Back
+// Read/Write-Allocate, iiii = 0b1111 Inner Write-Back Read/Write-Allocate
 #define MAIR_DEVICE_nGnRnE 0b00000000
 #define MAIR_NORMAL_NOCACHE 0b01000100
+#define MAIR_NORMAL_CACHE 0b11111111
 #define MAIR_IDX_DEVICE_nGnRnE 0
 #define MAIR_IDX_NORMAL_NOCACHE 1
+#define MAIR_IDX_NORMAL_CACHE 2
+#define MAIR_CONFIG_DEFAULT                                                    \
+  ((MAIR_DEVICE_nGnRnE << (MAIR_IDX_DEVICE_nGnRnE * 8)) |                      \
+   (MAIR_NORMAL_NOCACHE << (MAIR_IDX_NORMAL_NOCACHE * 8)) |                    \
+   (MAIR_NORMAL_CACHE << (MAIR_IDX_NORMAL_CACHE * 8)))
+
+// sctlr_el1: M[0] MMU enable, C[2] data cache enable, I[12] instruction cache
+// enable
+#define SCTLR_MMU_ENABLED (1 << 0)
+#define SCTLR_DCACHE_ENABLED (1 << 2)
+#define SCTLR_ICACHE_ENABLED (1 << 12)
+#define SCTLR_CONFIG_DEFAULT                                                   \
+  (SCTLR_MMU_ENABLED | SCTLR_DCACHE_ENABLED | SCTLR_ICACHE_ENABLED)
 
 #define PD_TABLE 0b11L       // Table Entry Armv8_a_address_translation p.14
 #define PD_BLOCK 0b01L       // Block Entry
@@ -34,6 +55,7 @@
 #define PD_RDONLY (1L << 7)  // 0 for read-write, 1 for read-only.
 #define PD_UK_ACCESS                                                           \
   (1L << 6) // 0 for only kernel access, 1 for user/kernel access.
+#define PD_INNER_SHARE (0b11L << 8) // SH[9:8] 0b11 for Inner Shareable
 
 // Used for EL1
 #define BOOT_PGD_ATTR (PD_TABLE)
@@ -44,6 +66,8 @@
    (MAIR_IDX_DEVICE_nGnRnE << 2) | PD_BLOCK)
 #define BOOT_PTE_ATTR_NOCACHE                                                  \
   (PD_ACCESS | (MAIR_IDX_NORMAL_NOCACHE << 2) | PD_BLOCK)
+#define BOOT_PTE_ATTR_CACHE                                                    \
+  (PD_ACCESS | PD_INNER_SHARE | (MAIR_IDX_NORMAL_CACHE << 2) | PD_BLOCK)
 
 #define MMU_PGD_BASE 0x2000L
 #define MMU_PGD_ADDR (MMU_PGD_BASE + 0x0000L)
@@ -0,0 +1,32 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include "dlist.h"
+#include "types.h"
+#include "vfs.h"
+
+#define PAGE_CACHE_DIRECT 0x1 // the page is the file itself, never dropped
+#define PAGE_CACHE_DIRTY 0x2  // stored to through a shared mapping
+#define PAGE_CACHE_FLAGS (PAGE_CACHE_DIRECT | PAGE_CACHE_DIRTY)
+
+/*
+ * The pages of one file that processes map read-only, so every process
+ * running a program shares a single copy of its text. The cache keeps a
+ * reference of its own on each page; a clean page nobody maps any more is
+ * given back by the shrinker. Dirty pages stay until written back.
+ */
+typedef struct page_cache {
+  double_linked_node_t node;
+  vnode_t *vnode;
+  uint32_t nr_pages;
+  uint64_t *pages; // physical address | PAGE_CACHE_DIRECT, 0 if not cached
+} page_cache_t;
+
+void page_cache_init();
+uint64_t page_cache_get(vnode_t *vnode, size_t offset);
+int page_cache_dirty(vnode_t *vnode, size_t offset);
+void page_cache_write(vnode_t *vnode, size_t pos, const void *buf, size_t len);
+int page_cache_writeback(vnode_t *vnode, size_t offset, size_t len);
+void page_cache_sync();
+
+#endif /* PAGECACHE_H */
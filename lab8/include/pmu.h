@@ -0,0 +1,37 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include "types.h"
+
+// PMUv3 event numbers, written to pmevtyper<n>_el0.
+#define PMU_L1D_TLB_REFILL 0x05
+
+// The cycle counter counts core cycles, unlike cntpct_el0.
+static inline uint64_t pmu_cycles() {
+  uint64_t cycles;
+  asm volatile("isb\n"
+               "mrs %0, pmccntr_el0"
+               : "=r"(cycles));
+  return cycles;
+}
+
+// Event counter 0.
+static inline uint64_t pmu_events() {
+  uint64_t events;
+  asm volatile("isb\n"
+               "mrs %0, pmevcntr0_el0"
+               : "=r"(events));
+  return events;
+}
+
+// Starts the cycle counter, and event counter 0 on event.
+static inline void pmu_enable(uint64_t event) {
+  uint64_t pmcr;
+  asm volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+  asm volatile("msr pmcr_el0, %0" ::"r"(pmcr | 1)); // E: enable counters
+  asm volatile("msr pmevtyper0_el0, %0" ::"r"(event));
+  asm volatile("msr pmcntenset_el0, %0" ::"r"((1UL << 31) | 1));
+  asm volatile("isb");
+}
+
+#endif /* PMU_H */
@@ -32,6 +32,16 @@ void do_cmd_preempt();
 void start_preemption_test(char *arg);
 void stop_preemption_test(char *arg);
 void do_cmd_freelist(int show_bitmap);
+void do_cmd_buddystat();
+void do_cmd_magazine(int level, int low, int high);
+void do_cmd_slabinfo();
+void do_cmd_meminfo();
+void do_cmd_allocprof();
+void do_cmd_membench();
+void do_cmd_tlbbench();
+void do_cmd_dmesg();
+void do_cmd_loglevel(int level);
+void do_cmd_compact(int order);
 void do_cmd_malloc(unsigned int size);
 void do_cmd_free(unsigned long addr);
 void do_cmd_sfree(unsigned long addr);
@@ -0,0 +1,28 @@
+#ifndef SHRINKER_H
+#define SHRINKER_H
+
+#include "types.h"
+
+#define MAX_SHRINKER_REG 0x10
+#define SHRINK_LOW_PAGES 1024  // start reclaiming below 4MB free
+#define SHRINK_HIGH_PAGES 2048 // and stop once 8MB are free again
+
+/*
+ * A cache that can give memory back under pressure. count() reports how
+ * many pages it could release, scan() releases up to nr_pages and returns
+ * how many it actually freed.
+ */
+typedef struct shrinker {
+  const char *name;
+  uint32_t (*count)();
+  uint32_t (*scan)(uint32_t nr_pages);
+  uint64_t calls;
+  uint64_t freed;
+} shrinker_t;
+
+int register_shrinker(const char *name, uint32_t (*count)(),
+                      uint32_t (*scan)(uint32_t nr_pages));
+uint32_t shrink_memory(uint32_t nr_pages);
+void shrinker_print_info();
+
+#endif /* SHRINKER_H */
@@ -0,0 +1,44 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "types.h"
+
+#define KMEM_CACHE_MAX 32
+#define KMEM_CACHE_NAME_MAX 23
+#define KMEM_CACHE_ALIGN 8
+#define KMEM_CACHE_EMPTY_MAX 1 // empty slabs kept before returning pages
+#define KMEM_FREELIST_END 0xFFFF
+#define KMEM_SLAB_MIN_OBJECTS 4    // large objects get multi-page slabs
+#define KMEM_SLAB_MAX_SIZE 0x10000 // freelist offsets are 16 bits
+
+/*
+ * Object cache in the style of kmem_cache. Every slab is a buddy block, large
+ * enough for a few objects, whose free objects are chained through their
+ * first 16 bits by offset, so allocation and free are a pop/push on the
+ * slab's freelist. Slabs are linked through the descriptor of their first
+ * frame and move between the partial, full and empty lists as objects are
+ * handed out and returned; every frame of a slab records its cache.
+ */
+typedef struct kmem_cache {
+  char name[KMEM_CACHE_NAME_MAX + 1];
+  uint32_t object_size;
+  uint32_t objects_per_slab;
+  uint32_t slab_size;
+  uint32_t slabs_partial; // frame index of the first slab of each list
+  uint32_t slabs_full;
+  uint32_t slabs_empty;
+  uint32_t partial_count;
+  uint32_t full_count;
+  uint32_t empty_count;
+  uint64_t active_objects;
+  uint64_t alloc_count;
+  uint64_t free_count;
+} kmem_cache_t;
+
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t object_size);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *object);
+kmem_cache_t *kmem_cache_of(void *object);
+void kmem_cache_print_info();
+
+#endif /* SLAB_H */
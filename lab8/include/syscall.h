@@ -2,6 +2,11 @@
 #define SYSCALL_H
 
 #include "types.h"
+
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+
 typedef struct trapframe {
   uint64_t x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15,
       x16, x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27, x28, x29, x30;
@@ -21,6 +26,8 @@ void signal_kill(int pid, int signal);
 void signal_return(trapframe_t *tpf);
 void *mmap(trapframe_t *tpf, void *addr, size_t len, int prot, int flags,
            int fd, int file_offset);
+int sys_munmap(trapframe_t *tpf, void *addr, size_t len);
+int sys_msync(trapframe_t *tpf, void *addr, size_t len, int flags);
 int sys_open(trapframe_t *tpf, const char *pathname, int flags);
 int sys_close(trapframe_t *tpf, int fd);
 long sys_write(trapframe_t *tpf, int fd, const void *buf, size_t count);
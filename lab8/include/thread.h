@@ -8,6 +8,7 @@
 #define PID_MAX 1024
 #define USTACK_SIZE 0x10000
 #define KSTACK_SIZE 0x10000
+#define THREAD_STACK_CACHE_MAX 8
 #define SIGNAL_MAX 64
 #define MAX_FD 16
 
@@ -33,6 +34,7 @@ typedef enum {
 typedef struct thread {
   double_linked_node_t node;
   thread_context_t context;
+  uint64_t asid; // generation | ASID, see mmu_asid
   thread_state_t state;
   int pid;
   // char *user_space;
@@ -45,20 +47,27 @@ typedef struct thread {
   void (*current_signal_handler)();
   int signal_running;
   double_linked_node_t vma_list;
+  struct vm_area_struct *vma_root; // the same areas, by address
+  struct vm_area_struct *vma_last; // last one a lookup found
   char cwd[MAX_PATH_NAME + 1];
   file_t *fdt[MAX_FD + 1];
 } thread_t;
 
-extern void switch_to(void *current_context, void *next_context);
+extern void switch_to(void *current_context, void *next_context,
+                      uint64_t ttbr0);
 extern void store_context(void *current_context);
 extern void load_context(void *current_context);
 extern thread_context_t *get_current();
 
 void thread_init();
 thread_t *thread_create(void *entry_point, uint32_t size);
-int exec_thread(char *data, uint32_t size);
+int exec_thread(vnode_t *file);
 void schedule();
 void kill_zombies();
+char *thread_stack_alloc();
+void thread_stack_free(char *stack);
+uint32_t thread_stack_shrink_count();
+uint32_t thread_stack_shrink_scan(uint32_t nr_pages);
 void thread_exit();
 void thread_test();
 void idle();
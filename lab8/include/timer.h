@@ -15,6 +15,24 @@ typedef struct timer_task {
   int priority;
 } timer_task_t;
 
+#ifdef ALLOCBENCH
+// provided by the host build in tools/allocbench
+unsigned long timer_get_counter();
+unsigned long timer_get_frequency();
+#else
+static inline unsigned long timer_get_counter() {
+  unsigned long cntpct_el0;
+  __asm__ __volatile__("mrs %0, cntpct_el0" : "=r"(cntpct_el0));
+  return cntpct_el0;
+}
+
+static inline unsigned long timer_get_frequency() {
+  unsigned long cntfrq_el0;
+  __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(cntfrq_el0));
+  return cntfrq_el0;
+}
+#endif
+
 void timer_init();
 void core_timer_enable();
 void core_timer_disable();
@@ -0,0 +1,14 @@
+#ifndef TLB_H
+#define TLB_H
+
+#include "types.h"
+
+// A range flush above this many pages drops the whole ASID instead: one
+// tlbi aside1is is cheaper than that many tlbi vae1is.
+#define TLB_FLUSH_RANGE_MAX_PAGES 64
+
+void tlb_flush_page(uint64_t asid, size_t va);
+void tlb_flush_range(uint64_t asid, size_t va, size_t size);
+void tlb_flush_asid(uint64_t asid);
+
+#endif /* TLB_H */
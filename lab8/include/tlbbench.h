@@ -0,0 +1,10 @@
+#ifndef TLBBENCH_H
+#define TLBBENCH_H
+
+#define TLBBENCH_VA 0x10000000L // user half, mapped for EL1 only
+#define TLBBENCH_PAGES 32       // touched after every switch
+#define TLBBENCH_ROUNDS 256
+
+void tlbbench_run();
+
+#endif /* TLBBENCH_H */
@@ -21,5 +21,6 @@ unsigned long str_to_hex(const char *str);
 void delay(int count);
 void *memcpy(void *dest, const void *src, unsigned int n);
 void *memset(void *src, int c, unsigned int n);
+void clear_page(void *page);
 
 #endif /* UTILS_H */
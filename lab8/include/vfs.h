@@ -16,6 +16,7 @@ typedef struct vnode {
   struct file_operations *f_ops;
   vnode_type_t type;
   void *internal;
+  struct page_cache *page_cache; // pages mapped into processes, see pagecache.c
 } vnode_t;
 
 typedef struct file {
@@ -43,6 +44,9 @@ typedef struct file_operations {
   int (*close)(struct file *file);
   long (*lseek64)(struct file *file, long offset, int whence);
   long (*getsize)(struct vnode *vd);
+  // Optional: the physical page holding the file's bytes at offset, when
+  // they already sit page-aligned in memory and can be mapped in place.
+  uint64_t (*map_page)(struct vnode *vd, size_t offset);
 } file_operations_t;
 
 typedef struct vnode_operations {
@@ -0,0 +1,42 @@
+#ifndef VMA_H
+#define VMA_H
+
+#include "dlist.h"
+#include "types.h"
+
+#define VMA_NO_GAP (~0UL)
+
+// An area is one region (text, stack, an mmap) backed either by the
+// contiguous memory at phys_addr (huge pages, devices, the signal
+// trampoline) or by the scattered single pages listed in pages[]. A
+// file-backed area starts with pages[] all zero and fills each entry from
+// vnode, at file_offset onwards, on the first touch of that page. A
+// MAP_SHARED one maps the file's page cache itself, writable, instead of
+// copying a page on the first write to it.
+// Areas sit on the thread's vma_list in insertion order and, keyed by
+// virt_addr, in an AVL tree. Each tree node also summarizes its subtree
+// (lowest start, highest end, widest hole between two of its areas) so a
+// free range can be found without visiting every area.
+typedef struct vm_area_struct {
+  double_linked_node_t node;
+  uint64_t virt_addr;
+  uint64_t phys_addr;
+  uint64_t area_size;
+  uint64_t rwx; // 1, 2, 4
+  int is_alloced;
+  uint64_t *pages; // physical address of each page, NULL when contiguous
+  struct vnode *vnode; // NULL unless file-backed
+  uint64_t file_offset;
+  int map_shared;
+  struct vm_area_struct *left, *right;
+  int height;
+  uint64_t subtree_start, subtree_end, subtree_gap;
+} vm_area_struct_t;
+
+void vma_tree_insert(vm_area_struct_t **root, vm_area_struct_t *vma);
+void vma_tree_remove(vm_area_struct_t **root, vm_area_struct_t *vma);
+vm_area_struct_t *vma_tree_find(vm_area_struct_t *root, uint64_t addr);
+uint64_t vma_tree_find_gap(vm_area_struct_t *root, uint64_t hint,
+                           uint64_t len, uint64_t align, uint64_t limit);
+
+#endif /* VMA_H */
@@ -0,0 +1,29 @@
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include "dlist.h"
+#include "mmu.h"
+#include "types.h"
+
+// Kernel virtual range above the 2GB linear map, reached through TTBR1.
+#define VMALLOC_START PHYS_TO_VIRT(0x80000000L)
+#define VMALLOC_END PHYS_TO_VIRT(0xC0000000L)
+#define VMALLOC_BATCH 64 // pages mapped per alloc_pages_bulk call
+
+/*
+ * A reserved piece of the vmalloc range. Areas are kept sorted by address;
+ * the first page of each is left unmapped as a guard, so running off the
+ * bottom of a vmalloc'ed kernel stack faults instead of corrupting the
+ * neighbouring area.
+ */
+typedef struct vmap_area {
+  double_linked_node_t node;
+  uint64_t start; // guard page included
+  uint64_t size;
+} vmap_area_t;
+
+void vmalloc_init();
+void *vmalloc(uint32_t size);
+void vfree(void *addr);
+
+#endif /* VMALLOC_H */
@@ -3,16 +3,20 @@
 #include "include/buddy_system.h"
 #include "include/cpio.h"
 #include "include/heap.h"
+#include "include/mmu.h"
+#include "include/slab.h"
 #include "include/types.h"
 #include "include/uart.h"
 #include "include/utils.h"
 #include "include/vfs.h"
 
 extern cpio_newc_header_t *cpio_header;
+extern kmem_cache_t *vnode_cache;
+extern kmem_cache_t *file_cache;
 
 file_operations_t initramfs_file_operations = {
-    initramfs_write, initramfs_read, initramfs_open,
-    initramfs_close, vfs_lseek64,    initramfs_getsize};
+    initramfs_write, initramfs_read,    initramfs_open,     initramfs_close,
+    vfs_lseek64,     initramfs_getsize, initramfs_map_page};
 vnode_operations_t initramfs_vnode_operations = {
     initramfs_lookup, initramfs_create, initramfs_mkdir};
 
@@ -62,16 +66,17 @@ int initramfs_setup_mount(filesystem_t *fs, mount_t *_mount) {
 int initramfs_sync() { return 0; }
 
 vnode_t *initramfs_create_vnode(mount_t *_mount, node_type_t type) {
-  vnode_t *v = memory_pool_allocator(sizeof(vnode_t), 0);
+  vnode_t *v = kmem_cache_alloc(vnode_cache);
   v->mount = _mount;
   v->v_ops = &initramfs_vnode_operations;
   v->f_ops = &initramfs_file_operations;
   v->type = INITRAM;
   initramfs_inode_t *inode =
-      memory_pool_allocator(sizeof(initramfs_inode_t), 0);
+      kmalloc(sizeof(initramfs_inode_t), GFP_KERNEL);
   simple_memset(inode, 0, sizeof(initramfs_inode_t));
   inode->type = type;
   v->internal = inode;
+  v->page_cache = NULL;
   return v;
 }
 
@@ -103,7 +108,7 @@ int initramfs_open(vnode_t *file_node, file_t **target) {
 }
 
 int initramfs_close(file_t *file) {
-  memory_pool_free(file, 0);
+  kmem_cache_free(file_cache, file);
   return 0;
 }
 
@@ -112,6 +117,18 @@ long initramfs_getsize(vnode_t *vd) {
   return inode->datasize;
 }
 
+// Whole pages the archive keeps page-aligned (tools/cpioalign lays files
+// out that way) are mapped straight out of the image. The last, partial
+// page never is: the bytes after the file belong to the next header.
+uint64_t initramfs_map_page(vnode_t *vd, size_t offset) {
+  initramfs_inode_t *inode = vd->internal;
+  uint64_t page = (uint64_t)inode->data + offset;
+  if ((page & (PAGE_SIZE - 1)) || offset + PAGE_SIZE > inode->datasize) {
+    return 0;
+  }
+  return VIRT_TO_PHYS(page);
+}
+
 int initramfs_lookup(vnode_t *dir_node, vnode_t **target,
                      const char *component_name) {
   initramfs_inode_t *dir_inode = dir_node->internal;
@@ -0,0 +1,116 @@
+#include "include/log.h"
+#include "include/uart.h"
+#include "include/utils.h"
+
+extern log_ring_t log_ring;
+extern int log_console_level;
+
+#define LOG_MASK (LOG_RING_SIZE - 1)
+
+// Move published up to pos unless another writer already went further.
+static void log_publish(uint64_t pos) {
+  uint64_t old = __atomic_load_n(&log_ring.published, __ATOMIC_RELAXED);
+  while (old < pos &&
+         !__atomic_compare_exchange_n(&log_ring.published, &old, pos, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+}
+
+void klog(int level, const char *fmt, ...) {
+  char line[LOG_LINE_MAX];
+  line[0] = '<';
+  line[1] = '0' + level;
+  line[2] = '>';
+  __builtin_va_list args;
+  __builtin_va_start(args, fmt);
+  vsnprintf(line + 3, LOG_LINE_MAX - 4, fmt, args);
+  __builtin_va_end(args);
+  uint32_t len = strlen(line);
+  if (line[len - 1] != '\n') {
+    line[len++] = '\n';
+  }
+
+  uint64_t pos = __atomic_fetch_add(&log_ring.head, len, __ATOMIC_RELAXED);
+  for (uint32_t i = 0; i < len; ++i) {
+    log_ring.buf[(pos + i) & LOG_MASK] = line[i];
+  }
+  __atomic_fetch_add(&log_ring.committed, len, __ATOMIC_RELEASE);
+
+  // A writer we interrupted still owns an earlier slot; it publishes for
+  // both of us when it commits.
+  uint64_t head = __atomic_load_n(&log_ring.head, __ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&log_ring.committed, __ATOMIC_ACQUIRE) == head) {
+    log_publish(head);
+    *AUX_MU_IER |= 0x02; // let the TX interrupt drain it
+  }
+}
+
+// Called from the UART TX interrupt task: send what the transmitter takes
+// without waiting. Returns 1 while published lines remain.
+int log_console_drain() {
+  uint64_t end = __atomic_load_n(&log_ring.published, __ATOMIC_ACQUIRE);
+  if (end - log_ring.console > LOG_RING_SIZE) {
+    log_ring.dropped += end - LOG_RING_SIZE - log_ring.console;
+    log_ring.console = end - LOG_RING_SIZE;
+    // resume at the next line start
+    while (log_ring.console < end &&
+           log_ring.buf[log_ring.console++ & LOG_MASK] != '\n') {
+    }
+  }
+  while (log_ring.console < end && (*AUX_MU_LSR & 0x20)) {
+    char c = log_ring.buf[log_ring.console & LOG_MASK];
+    if (c == '<' && (log_ring.console == 0 ||
+                     log_ring.buf[(log_ring.console - 1) & LOG_MASK] == '\n')) {
+      int level = log_ring.buf[(log_ring.console + 1) & LOG_MASK] - '0';
+      log_ring.console_skip = level > log_console_level;
+      log_ring.console += 3;
+      continue;
+    }
+    log_ring.console++;
+    if (log_ring.console_skip) {
+      continue;
+    }
+    if (c == '\n') {
+      *AUX_MU_IO = '\r';
+      while (!(*AUX_MU_LSR & 0x20)) {
+      }
+    }
+    *AUX_MU_IO = c;
+  }
+  return log_ring.console < end;
+}
+
+void log_set_console_level(int level) { log_console_level = level; }
+
+// Print every line still in the ring, oldest first.
+void log_dmesg() {
+  uint64_t end = __atomic_load_n(&log_ring.published, __ATOMIC_ACQUIRE);
+  uint64_t pos = end > LOG_RING_SIZE ? end - LOG_RING_SIZE : 0;
+  if (pos > 0) {
+    while (pos < end && log_ring.buf[pos++ & LOG_MASK] != '\n') {
+    }
+  }
+  static const char levels[] = "EWID";
+  int line_start = 1;
+  for (; pos < end; ++pos) {
+    char c = log_ring.buf[pos & LOG_MASK];
+    if (line_start && c == '<') {
+      int level = log_ring.buf[(pos + 1) & LOG_MASK] - '0';
+      uart_putc('[');
+      uart_putc(levels[level & 3]);
+      uart_putc(']');
+      uart_putc(' ');
+      pos += 2;
+      line_start = 0;
+      continue;
+    }
+    if (c == '\n') {
+      uart_putc('\r');
+    }
+    uart_putc(c);
+    line_start = c == '\n';
+  }
+  if (log_ring.dropped) {
+    uart_sendline("[%l bytes never reached the console]\n", log_ring.dropped);
+  }
+}
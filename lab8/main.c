@@ -9,6 +9,7 @@
 #include "include/timer.h"
 #include "include/uart.h"
 #include "include/vfs.h"
+#include "include/vmalloc.h"
 
 extern char *dtb_ptr;
 extern char _start;
@@ -16,6 +17,36 @@ extern char _end;
 extern char *heap_ptr;
 extern int init_done;
 
+#define BOOT_STAGE_MAX 16
+
+static const char *boot_stage_name[BOOT_STAGE_MAX];
+static uint64_t boot_stage_ticks[BOOT_STAGE_MAX];
+static uint32_t boot_stage_count = 0;
+static uint64_t boot_stage_last;
+
+// Record the end of a boot stage; printed later so UART output from the
+// report itself does not skew the numbers.
+static void boot_stage_mark(const char *name) {
+  uint64_t now = timer_get_counter();
+  if (boot_stage_count < BOOT_STAGE_MAX) {
+    boot_stage_name[boot_stage_count] = name;
+    boot_stage_ticks[boot_stage_count++] = now - boot_stage_last;
+  }
+  boot_stage_last = now;
+}
+
+static void boot_stage_print() {
+  uint64_t freq = timer_get_frequency();
+  uint64_t total = 0;
+  uart_sendline("============================\n");
+  for (uint32_t i = 0; i < boot_stage_count; ++i) {
+    uart_sendline("[Boot] %s: %l us\n", boot_stage_name[i],
+                  boot_stage_ticks[i] * 1000000 / freq);
+    total += boot_stage_ticks[i];
+  }
+  uart_sendline("[Boot] total: %l us\n", total * 1000000 / freq);
+}
+
 unsigned long get_stack_pointer() {
   unsigned long sp;
   __asm__ volatile("mov %0, sp" : "=r"(sp));
@@ -23,6 +54,7 @@ unsigned long get_stack_pointer() {
 }
 
 int main(char *arg) {
+  boot_stage_last = timer_get_counter();
   dtb_ptr = PHYS_TO_VIRT(arg);
   uart_init();
   uart_sendline("Code start at address: 0x%p.\n", (unsigned long)&_start);
@@ -31,18 +63,29 @@ int main(char *arg) {
   uart_sendline("DTB header at address: 0x%p.\n", (unsigned long)dtb_ptr);
   dtb_initramfs_init();
   heap_init();
+  boot_stage_mark("early init");
   uart_getc();
+  boot_stage_last = timer_get_counter(); // not counting the wait for a key
   startup_memory_block_table_init();
+  boot_stage_mark("startup reservations");
   buddy_system_init();
+  boot_stage_mark("buddy system");
   memory_pool_init();
+  vmalloc_init();
+  boot_stage_mark("memory pool");
   buddy_system_print_freelists(0);
   uart_sendline("============================\n");
+  boot_stage_mark("freelist dump");
 
   init_rootfs();
+  boot_stage_mark("rootfs");
   thread_init();
   timer_init();
   irq_task_list_init();
+  heap_release();
+  boot_stage_mark("threads, timer, irq");
   init_done = 1;
+  boot_stage_print();
   uart_sendline("Heap pointer now at address: 0x%p.\n",
                 (unsigned long)heap_ptr);
 
@@ -24,13 +24,16 @@
  */
 
 #include "include/mbox.h"
+#include "include/cache.h"
 #include "include/uart.h"
 
-volatile unsigned int __attribute__((aligned(16))) mbox[64];
+volatile unsigned int __attribute__((aligned(64))) mbox[64];
 
 int mbox_call(unsigned char ch) {
   unsigned int r = (((unsigned int)((unsigned long)&mbox) & ~0xF) | (ch & 0xF));
 
+  // the VideoCore reads and writes the buffer in memory, bypassing our caches
+  cache_clean_invalidate_range((void *)mbox, sizeof(unsigned int) * 64);
   do {
     asm volatile("nop");
   } while (*MBOX_STATUS & MBOX_FULL);
@@ -40,8 +43,10 @@ int mbox_call(unsigned char ch) {
     do {
       asm volatile("nop");
     } while (*MBOX_STATUS & MBOX_EMPTY);
-    if (r == *MBOX_READ)
+    if (r == *MBOX_READ) {
+      cache_invalidate_range((void *)mbox, sizeof(unsigned int) * 64);
       return mbox[1] == MBOX_RESPONSE;
+    }
   }
 
   return 0;
@@ -0,0 +1,137 @@
+#include "include/meminfo.h"
+#include "include/buddy_system.h"
+#include "include/exception.h"
+#include "include/shrinker.h"
+#include "include/slab.h"
+#include "include/types.h"
+#include "include/uart.h"
+#include "include/utils.h"
+#include "include/vmalloc.h"
+
+extern buddy_system_node_t buddy_system[];
+extern uint64_t buddy_system_free_pages;
+extern buddy_system_stats_t buddy_system_stats;
+extern buddy_system_magazine_t buddy_system_magazines[];
+extern buddy_system_zero_pool_t buddy_system_zero_pool;
+extern kmem_cache_t kmem_caches[];
+extern uint32_t kmem_cache_count;
+extern shrinker_t shrinkers[];
+extern uint64_t vmalloc_pages;
+extern uint8_t buddy_system_pageblock_type[];
+
+uint32_t meminfo_append(char *buf, uint32_t size, uint32_t len,
+                        const char *fmt, ...) {
+  if (len + 1 >= size) {
+    return len;
+  }
+  __builtin_va_list args;
+  __builtin_va_start(args, fmt);
+  vsnprintf(buf + len, size - len, fmt, args);
+  __builtin_va_end(args);
+  return len + strlen(buf + len);
+}
+
+// Unusable free space index of an order, in thousandths: the share of free
+// memory sitting in blocks too small to serve a request of that order.
+uint32_t meminfo_fragmentation(uint32_t order) {
+  if (buddy_system_free_pages == 0) {
+    return 0;
+  }
+  uint64_t usable = 0;
+  for (uint32_t i = order; i <= MAX_LEVEL; ++i) {
+    usable += (uint64_t)buddy_system[i].count << i;
+  }
+  return (buddy_system_free_pages - usable) * 1000 / buddy_system_free_pages;
+}
+
+// Snapshot of allocator state as text, also served by /dev/meminfo.
+uint32_t meminfo_render(char *buf, uint32_t size) {
+  uint32_t len = 0;
+  buddy_system_stats_t *s = &buddy_system_stats;
+  lock();
+  uint32_t cached = 0;
+  for (uint32_t i = 0; i < MAGAZINE_LEVELS; ++i) {
+    cached += buddy_system_magazines[i].count << i;
+  }
+  len = meminfo_append(buf, size, len, "MemTotal:    %l kB\n",
+                       (uint64_t)TOTAL_MEMORY >> 10);
+  len = meminfo_append(buf, size, len, "MemFree:     %l kB\n",
+                       buddy_system_free_pages << (PAGE_SHIFT - 10));
+  len = meminfo_append(buf, size, len, "Magazines:   %u kB\n",
+                       cached << (PAGE_SHIFT - 10));
+  len = meminfo_append(buf, size, len,
+                       "ZeroPool:    %u kB (%l hits, %l misses)\n",
+                       buddy_system_zero_pool.count << (PAGE_SHIFT - 10),
+                       buddy_system_zero_pool.hits,
+                       buddy_system_zero_pool.misses);
+  len = meminfo_append(buf, size, len, "VmallocUsed: %l kB\n",
+                       vmalloc_pages << (PAGE_SHIFT - 10));
+  len = meminfo_append(buf, size, len,
+                       "Splits: %l  Merges: %l  Failures: %l\n", s->splits,
+                       s->merges, s->failures);
+  uint32_t movable = 0;
+  for (uint32_t i = 0; i < PAGEBLOCK_COUNT; ++i) {
+    movable += buddy_system_pageblock_type[i] == MIGRATE_MOVABLE;
+  }
+  len = meminfo_append(buf, size, len,
+                       "Pageblocks:  %u unmovable, %u movable, %l steals, %l "
+                       "fallbacks\n",
+                       PAGEBLOCK_COUNT - movable, movable, s->steals,
+                       s->fallbacks);
+  len = meminfo_append(buf, size, len,
+                       "Compaction:  %l runs, %l succeeded, %l pages "
+                       "migrated, %l ticks\n",
+                       s->compact_runs, s->compact_success,
+                       s->compact_migrated, s->compact_ticks);
+  len = meminfo_append(buf, size, len,
+                       "order  free      allocs      frees  frag\n");
+  for (uint32_t i = 0; i <= MAX_LEVEL; ++i) {
+    uint32_t frag = meminfo_fragmentation(i);
+    len = meminfo_append(buf, size, len, "%u\t%u\t%l\t%l\t%u.", i,
+                         buddy_system[i].count, s->order_allocs[i],
+                         s->order_frees[i], frag / 1000);
+    len = meminfo_append(buf, size, len, "%u%u%u\n", frag / 100 % 10,
+                         frag / 10 % 10, frag % 10);
+  }
+
+  len = meminfo_append(buf, size, len,
+                       "cache                   active  total   slabs\n");
+  for (uint32_t i = 0; i < kmem_cache_count; ++i) {
+    kmem_cache_t *cache = &kmem_caches[i];
+    uint32_t slabs =
+        cache->partial_count + cache->full_count + cache->empty_count;
+    len = meminfo_append(buf, size, len, "%s", cache->name);
+    for (uint32_t pad = strlen(cache->name); pad < 24; ++pad) {
+      len = meminfo_append(buf, size, len, " ");
+    }
+    len = meminfo_append(buf, size, len, "%l\t%u\t%u\n",
+                         cache->active_objects,
+                         slabs * cache->objects_per_slab, slabs);
+  }
+
+  for (int i = 0; i < MAX_SHRINKER_REG; ++i) {
+    if (shrinkers[i].name) {
+      len = meminfo_append(buf, size, len,
+                           "shrinker %s: %l calls, %l pages freed\n",
+                           shrinkers[i].name, shrinkers[i].calls,
+                           shrinkers[i].freed);
+    }
+  }
+  unlock();
+  return len;
+}
+
+void meminfo_print() {
+  char *buf = vmalloc(MEMINFO_BUF_SIZE);
+  if (!buf) {
+    return;
+  }
+  meminfo_render(buf, MEMINFO_BUF_SIZE);
+  for (char *c = buf; *c; ++c) {
+    if (*c == '\n') {
+      uart_putc('\r');
+    }
+    uart_putc(*c);
+  }
+  vfree(buf);
+}
@@ -1,15 +1,26 @@
 #include "include/mmu.h"
 #include "include/allocator.h"
 #include "include/buddy_system.h"
+#include "include/cache.h"
 #include "include/exception.h"
 #include "include/heap.h"
+#include "include/log.h"
+#include "include/pagecache.h"
+#include "include/slab.h"
 #include "include/thread.h"
+#include "include/tlb.h"
 #include "include/types.h"
 #include "include/uart.h"
 #include "include/utils.h"
 
 extern thread_t *current_thread;
+extern thread_t thread_table[];
 extern frame_array_node_t frame_array[];
+extern kmem_cache_t *vma_cache;
+extern uint64_t asid_generation;
+extern uint64_t asid_next;
+extern uint64_t asid_rollovers;
+extern uint64_t asid_reserved_ttbr0;
 
 void *set_2M_kernel_mmu(void *x0) {
   // Turn
@@ -24,8 +35,11 @@ void *set_2M_kernel_mmu(void *x0) {
     uint64_t addr = 0x200000L * i;
     if (addr >= PERIPHERAL_END) {
       pte_table1[i] = (0x00000000 + addr) | BOOT_PTE_ATTR_nGnRnE;
-    } else {
+    } else if (addr >= PERIPHERAL_START) {
+      // GPU memory (framebuffer) stays non-cacheable
       pte_table1[i] = (0x00000000 + addr) | BOOT_PTE_ATTR_NOCACHE;
+    } else {
+      pte_table1[i] = (0x00000000 + addr) | BOOT_PTE_ATTR_CACHE;
     }
     pte_table2[i] = (0x40000000 + addr) | BOOT_PTE_ATTR_nGnRnE; // 512 * 2MB
   }
@@ -35,91 +49,630 @@ void *set_2M_kernel_mmu(void *x0) {
   return x0;
 }
 
-void map_one_page(size_t *virt_pgd_p, size_t va, size_t pa, size_t flag) {
+size_t mmu_memory_attr(size_t pa) {
+  if (pa >= PERIPHERAL_START && pa < PERIPHERAL_END) {
+    return MAIR_IDX_NORMAL_NOCACHE << 2;
+  }
+  return PD_INNER_SHARE | (MAIR_IDX_NORMAL_CACHE << 2);
+}
+
+// User mappings are per address space and must not outlive a switch of
+// ttbr0_el1; the kernel half stays global.
+static size_t mmu_ng(size_t va) { return va >> 48 ? 0 : PD_NG; }
+
+// Returns -1 when a page table cannot be allocated.
+int map_one_page(size_t *virt_pgd_p, size_t va, size_t pa, size_t flag) {
   size_t *table_p = virt_pgd_p;
   for (int level = 0; level < 4; level++) {
     uint32_t idx = (va >> (39 - level * 9)) & 0x1ff;
     if (level == 3) {
       table_p[idx] = pa;
       table_p[idx] |=
-          PD_KNX | PD_ACCESS | (MAIR_IDX_NORMAL_NOCACHE << 2) | PD_TABLE | flag;
-      return;
+          PD_KNX | PD_ACCESS | mmu_memory_attr(pa) | mmu_ng(va) | PD_TABLE |
+          flag;
+      return 0;
     }
     if (!table_p[idx]) {
-      size_t *newtable_p = (size_t *)buddy_system_allocator(0x1000);
-      simple_memset(newtable_p, 0, 0x1000);
+      uint64_t newtable;
+      if (!alloc_pages_bulk(1, &newtable, GFP_KERNEL | __GFP_ZERO)) {
+        return -1;
+      }
+      size_t *newtable_p = (size_t *)newtable;
       table_p[idx] = VIRT_TO_PHYS((size_t)newtable_p);
-      table_p[idx] |= PD_ACCESS | (MAIR_IDX_NORMAL_NOCACHE << 2) | PD_TABLE;
+      table_p[idx] |= PD_ACCESS | (MAIR_IDX_NORMAL_CACHE << 2) | PD_TABLE;
+    }
+    table_p = (size_t *)PHYS_TO_VIRT((size_t)(table_p[idx] & ENTRY_ADDR_MASK));
+  }
+  return 0;
+}
+
+// Map the 2MB block at pa with one level 2 block entry. A level 3 table left
+// over from earlier single-page mappings of the range is dropped.
+int map_huge_page(size_t *virt_pgd_p, size_t va, size_t pa, size_t flag) {
+  size_t *table_p = virt_pgd_p;
+  for (int level = 0; level < 2; level++) {
+    uint32_t idx = (va >> (39 - level * 9)) & 0x1ff;
+    if (!table_p[idx]) {
+      uint64_t newtable;
+      if (!alloc_pages_bulk(1, &newtable, GFP_KERNEL | __GFP_ZERO)) {
+        return -1;
+      }
+      table_p[idx] = VIRT_TO_PHYS(newtable);
+      table_p[idx] |= PD_ACCESS | (MAIR_IDX_NORMAL_CACHE << 2) | PD_TABLE;
     }
     table_p = (size_t *)PHYS_TO_VIRT((size_t)(table_p[idx] & ENTRY_ADDR_MASK));
   }
+  size_t *pmd = &table_p[(va >> 21) & 0x1ff];
+  if ((*pmd & 0b11) == PD_TABLE) {
+    buddy_system_free((uint64_t)PHYS_TO_VIRT((*pmd & ENTRY_ADDR_MASK)));
+  }
+  *pmd = pa | PD_KNX | PD_ACCESS | mmu_memory_attr(pa) | mmu_ng(va) |
+         PD_BLOCK | flag;
+  return 0;
 }
 
-void mmu_add_vma(thread_t *t, size_t va, size_t size, size_t pa, size_t rwx,
-                 int is_alloced) {
+// Level 2 entry for va, or NULL when no table covers it.
+size_t *mmu_find_pmd(size_t *virt_pgd_p, size_t va) {
+  size_t *table_p = virt_pgd_p;
+  for (int level = 0; level < 2; level++) {
+    uint32_t idx = (va >> (39 - level * 9)) & 0x1ff;
+    if ((table_p[idx] & 0b11) != PD_TABLE) {
+      return NULL;
+    }
+    table_p = (size_t *)PHYS_TO_VIRT((size_t)(table_p[idx] & ENTRY_ADDR_MASK));
+  }
+  return &table_p[(va >> 21) & 0x1ff];
+}
+
+// Level 3 entry for va, or NULL when no table covers it.
+size_t *mmu_find_pte(size_t *virt_pgd_p, size_t va) {
+  size_t *table_p = virt_pgd_p;
+  for (int level = 0; level < 3; level++) {
+    uint32_t idx = (va >> (39 - level * 9)) & 0x1ff;
+    if ((table_p[idx] & 0b11) != PD_TABLE) { // missing, or a block entry
+      return NULL;
+    }
+    table_p = (size_t *)PHYS_TO_VIRT((size_t)(table_p[idx] & ENTRY_ADDR_MASK));
+  }
+  return &table_p[(va >> PAGE_SHIFT) & 0x1ff];
+}
+
+vm_area_struct_t *mmu_add_vma(thread_t *t, size_t va, size_t size, size_t pa,
+                              size_t rwx, int is_alloced) {
   size = size % 0x1000 ? size + (0x1000 - size % 0x1000) : size;
-  vm_area_struct_t *new_area =
-      memory_pool_allocator(sizeof(vm_area_struct_t), 0);
+  vm_area_struct_t *new_area = kmem_cache_alloc(vma_cache);
+  if (!new_area) {
+    return NULL;
+  }
   new_area->virt_addr = va;
   new_area->phys_addr = pa;
   new_area->area_size = size;
   new_area->rwx = rwx;
   new_area->is_alloced = is_alloced;
+  new_area->pages = NULL;
+  new_area->vnode = NULL;
+  new_area->file_offset = 0;
+  new_area->map_shared = 0;
   double_linked_add_before((double_linked_node_t *)new_area, &t->vma_list);
+  vma_tree_insert(&t->vma_root, new_area);
+  return new_area;
+}
+
+static void mmu_remove_vma(thread_t *t, vm_area_struct_t *vma) {
+  if (t->vma_last == vma) {
+    t->vma_last = NULL;
+  }
+  vma_tree_remove(&t->vma_root, vma);
+  double_linked_remove((double_linked_node_t *)vma);
+  kfree(vma->pages);
+  kmem_cache_free(vma_cache, vma);
+}
+
+uint64_t mmu_vma_phys(vm_area_struct_t *vma, size_t offset) {
+  if (vma->pages) {
+    return vma->pages[offset / PAGE_SIZE] + offset % PAGE_SIZE;
+  }
+  return vma->phys_addr + offset;
+}
+
+// Add or drop a user reference on every frame of vma, one
+// frame_ref_range per physically contiguous run. With delta -1, frames
+// left without references are handed to free_pages_bulk. Pages a
+// file-backed area has not faulted in yet are skipped.
+static void mmu_vma_ref(vm_area_struct_t *vma, int delta) {
+  uint32_t nr_pages = vma->area_size / PAGE_SIZE;
+  if (!vma->pages) {
+    frame_ref_range(vma->phys_addr, nr_pages, delta);
+    if (delta < 0 && !frame_array[vma->phys_addr / PAGE_SIZE].ref) {
+      uint64_t block = PHYS_TO_VIRT(vma->phys_addr);
+      free_pages_bulk(1, &block);
+    }
+    return;
+  }
+  uint64_t batch[MMU_FREE_BATCH];
+  uint32_t batch_count = 0;
+  uint32_t run = 0;
+  for (uint32_t i = 0; i < nr_pages; ++i) {
+    if (!vma->pages[i]) {
+      run = i + 1;
+      continue;
+    }
+    if (i + 1 < nr_pages && vma->pages[i + 1] == vma->pages[i] + PAGE_SIZE) {
+      continue;
+    }
+    uint64_t start = vma->pages[run];
+    frame_ref_range(start, i + 1 - run, delta);
+    for (; delta < 0 && run <= i; ++run) {
+      if (!frame_array[vma->pages[run] / PAGE_SIZE].ref) {
+        batch[batch_count++] = PHYS_TO_VIRT(vma->pages[run]);
+        if (batch_count == MMU_FREE_BATCH) {
+          free_pages_bulk(batch_count, batch);
+          batch_count = 0;
+        }
+      }
+    }
+    run = i + 1;
+  }
+  if (batch_count) {
+    free_pages_bulk(batch_count, batch);
+  }
+}
+
+// The area of t holding va, or NULL. Faults tend to hit the area of the
+// previous one, so that is tried before the tree.
+vm_area_struct_t *mmu_find_vma(thread_t *t, size_t va) {
+  vm_area_struct_t *vma = t->vma_last;
+  if (vma && va >= vma->virt_addr && va < vma->virt_addr + vma->area_size) {
+    return vma;
+  }
+  vma = vma_tree_find(t->vma_root, va);
+  if (vma) {
+    t->vma_last = vma;
+  }
+  return vma;
+}
+
+// Make pages[] (kernel virtual addresses, from kmalloc) the page array of
+// one area at va and take a user reference on each page. The area owns the
+// array afterwards and holds physical addresses in it. Returns -1, with
+// pages[] untouched, when the area cannot be allocated.
+int mmu_add_vma_pages(thread_t *t, size_t va, uint64_t *pages,
+                      uint32_t nr_pages, size_t rwx) {
+  vm_area_struct_t *vma = mmu_add_vma(t, va, nr_pages * PAGE_SIZE, 0, rwx, 1);
+  if (!vma) {
+    return -1;
+  }
+  for (uint32_t i = 0; i < nr_pages; ++i) {
+    pages[i] = VIRT_TO_PHYS(pages[i]);
+  }
+  vma->pages = pages;
+  mmu_vma_ref(vma, 1);
+  return 0;
+}
+
+// Give t a copy of vma sharing its frames, as fork does. Returns -1 when
+// out of memory.
+int mmu_dup_vma(thread_t *t, vm_area_struct_t *vma) {
+  uint64_t *pages = NULL;
+  if (vma->pages) {
+    pages = kmalloc(vma->area_size / PAGE_SIZE * sizeof(uint64_t), GFP_KERNEL);
+    if (!pages) {
+      return -1;
+    }
+    memcpy(pages, vma->pages, vma->area_size / PAGE_SIZE * sizeof(uint64_t));
+  }
+  vm_area_struct_t *copy = mmu_add_vma(t, vma->virt_addr, vma->area_size,
+                                       vma->phys_addr, vma->rwx,
+                                       vma->is_alloced);
+  if (!copy) {
+    kfree(pages);
+    return -1;
+  }
+  copy->pages = pages;
+  copy->vnode = vma->vnode;
+  copy->file_offset = vma->file_offset;
+  copy->map_shared = vma->map_shared;
+  if (copy->is_alloced) {
+    mmu_vma_ref(copy, 1);
+  }
+  return 0;
+}
+
+static inline int mmu_vma_is_huge(vm_area_struct_t *vma) {
+  return vma->is_alloced && !vma->pages && vma->area_size == HUGE_PAGE_SIZE;
+}
+
+// Install every page of vma in the page tables, as one block entry when the
+// area is a huge page. Returns -1 when a page table cannot be allocated.
+int mmu_map_area(size_t *virt_pgd_p, vm_area_struct_t *vma, size_t flag) {
+  if (mmu_vma_is_huge(vma)) {
+    return map_huge_page(virt_pgd_p, vma->virt_addr, vma->phys_addr, flag);
+  }
+  for (int i = 0; i < vma->area_size / PAGE_SIZE; ++i) {
+    if (map_one_page(virt_pgd_p, vma->virt_addr + i * PAGE_SIZE,
+                     mmu_vma_phys(vma, i * PAGE_SIZE), flag) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int mmu_fork_table(size_t *from, size_t *to, int level, size_t va,
+                          size_t end, size_t wrprotect) {
+  uint32_t shift = 39 - level * 9;
+  while (va < end) {
+    uint32_t idx = (va >> shift) & 0x1ff;
+    size_t next = ((va >> shift) + 1) << shift;
+    next = next < end ? next : end;
+    size_t entry = from[idx];
+    if (!entry) {
+      va = next;
+      continue;
+    }
+    if (level == 3 || (entry & 0b11) == PD_BLOCK) {
+      from[idx] = entry | wrprotect;
+      to[idx] = entry | wrprotect;
+      va = next;
+      continue;
+    }
+    if (!to[idx]) {
+      uint64_t newtable;
+      if (!alloc_pages_bulk(1, &newtable, GFP_KERNEL | __GFP_ZERO)) {
+        return -1;
+      }
+      to[idx] = VIRT_TO_PHYS(newtable) | PD_ACCESS |
+                (MAIR_IDX_NORMAL_CACHE << 2) | PD_TABLE;
+    }
+    if (mmu_fork_table((size_t *)PHYS_TO_VIRT((entry & ENTRY_ADDR_MASK)),
+                       (size_t *)PHYS_TO_VIRT((to[idx] & ENTRY_ADDR_MASK)),
+                       level + 1, va, next, wrprotect)) {
+      return -1;
+    }
+    va = next;
+  }
+  return 0;
+}
+
+// Share the present entries of [va, va + size) with a forked child, adding
+// wrprotect (PD_RDONLY or 0) on both sides. Each table is visited once, not
+// once per page. Absent entries stay absent; the fault handler maps a
+// still-shared frame read-only. Returns -1 when a table cannot be allocated.
+int mmu_fork_range(size_t *from_pgd, size_t *to_pgd, size_t va, size_t size,
+                   size_t wrprotect) {
+  return mmu_fork_table(from_pgd, to_pgd, 0, va, va + size, wrprotect);
+}
+
+// Back [va, va + len) with fresh user memory. Each 2MB-aligned 2MB piece
+// gets a huge page when an order 9 block is free; everything else becomes
+// one area of single pages per stretch between 2MB boundaries. Nothing is
+// mapped yet: the first touch faults the huge page or the single page in.
+// On failure the areas added here are released again and -1 is returned.
+int mmu_map_anon(thread_t *t, size_t va, size_t len, size_t rwx) {
+  double_linked_node_t *last = t->vma_list.prev;
+  size_t end = va + len;
+  while (va < end) {
+    if (!(va & (HUGE_PAGE_SIZE - 1)) && end - va >= HUGE_PAGE_SIZE) {
+      uint64_t block = alloc_huge_page();
+      if (block) {
+        vm_area_struct_t *vma =
+            mmu_add_vma(t, va, HUGE_PAGE_SIZE, VIRT_TO_PHYS(block), rwx, 1);
+        if (!vma) {
+          free_pages_bulk(1, &block);
+          goto fail;
+        }
+        mmu_vma_ref(vma, 1);
+        va += HUGE_PAGE_SIZE;
+        continue;
+      }
+    }
+    // single pages up to the next 2MB boundary
+    size_t next = (va + HUGE_PAGE_SIZE) & ~(HUGE_PAGE_SIZE - 1);
+    next = next < end ? next : end;
+    uint32_t n = (next - va) / PAGE_SIZE;
+    uint64_t *pages = kmalloc(n * sizeof(uint64_t), GFP_KERNEL);
+    if (!pages || !alloc_pages_bulk(n, pages, GFP_USER)) {
+      kfree(pages);
+      goto fail;
+    }
+    if (mmu_add_vma_pages(t, va, pages, n, rwx)) {
+      free_pages_bulk(n, pages);
+      kfree(pages);
+      goto fail;
+    }
+    va = next;
+  }
+  return 0;
+
+fail:
+  while (t->vma_list.prev != last) {
+    vm_area_struct_t *vma = (vm_area_struct_t *)t->vma_list.prev;
+    mmu_vma_ref(vma, -1);
+    mmu_remove_vma(t, vma);
+  }
+  return -1;
+}
+
+// Back [va, va + len) with the file behind vnode, from offset on. Nothing
+// is read yet: each page is faulted in on first touch, shared through the
+// file's page cache until written (for good when map_shared), and zero
+// past the end of the file.
+int mmu_map_file(thread_t *t, size_t va, size_t len, size_t rwx,
+                 vnode_t *vnode, size_t offset, int map_shared) {
+  uint32_t nr_pages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+  uint64_t *pages =
+      kmalloc(nr_pages * sizeof(uint64_t), GFP_KERNEL | __GFP_ZERO);
+  if (!pages) {
+    return -1;
+  }
+  vm_area_struct_t *vma = mmu_add_vma(t, va, len, 0, rwx, 1);
+  if (!vma) {
+    kfree(pages);
+    return -1;
+  }
+  vma->pages = pages;
+  vma->vnode = vnode;
+  vma->file_offset = offset;
+  vma->map_shared = map_shared;
+  return 0;
+}
+
+// First touch of the page at offset in a file-backed area.
+static int mmu_fault_in_file(vm_area_struct_t *vma, size_t offset) {
+  long file_pos = vma->file_offset + offset;
+  uint64_t pa;
+  if (file_pos < vma->vnode->f_ops->getsize(vma->vnode)) {
+    pa = page_cache_get(vma->vnode, file_pos);
+    if (!pa) {
+      return -1;
+    }
+  } else {
+    uint64_t page;
+    if (!alloc_pages_bulk(1, &page, GFP_USER | __GFP_ZERO)) {
+      return -1;
+    }
+    pa = VIRT_TO_PHYS(page);
+    frame_array[pa / PAGE_SIZE].ref++;
+  }
+  vma->pages[offset / PAGE_SIZE] = pa;
+  return 0;
+}
+
+// Make every shared file mapping of frame pa read-only again, so the next
+// store faults and marks the page dirty. Like migration, this finds the
+// mappings by walking the areas of every live thread.
+void mmu_wrprotect_page(uint64_t pa) {
+  for (int i = 0; i <= PID_MAX; ++i) {
+    thread_t *t = &thread_table[i];
+    if (t->state != THREAD_READY && t->state != THREAD_RUNNING) {
+      continue;
+    }
+    uint64_t pgd = (uint64_t)t->context.pgd;
+    pgd = pgd < BUDDY_MEMORY_BASE ? PHYS_TO_VIRT(pgd) : pgd;
+    double_linked_node_t *cur;
+    double_linked_for_each(cur, &t->vma_list) {
+      vm_area_struct_t *vma = (vm_area_struct_t *)cur;
+      if (!vma->map_shared) {
+        continue;
+      }
+      for (uint32_t idx = 0; idx < vma->area_size / PAGE_SIZE; ++idx) {
+        if (vma->pages[idx] != pa) {
+          continue;
+        }
+        size_t va = vma->virt_addr + idx * PAGE_SIZE;
+        size_t *pte = mmu_find_pte((size_t *)pgd, va);
+        if (pte && (*pte & ENTRY_ADDR_MASK) == pa && !(*pte & PD_RDONLY)) {
+          *pte |= PD_RDONLY;
+          tlb_flush_page(t->asid, va);
+        }
+      }
+    }
+  }
+}
+
+// Cut vma in two at va, a page boundary inside it. Only areas of single
+// pages can be cut; a contiguous block is unmapped whole or not at all.
+static int mmu_split_vma(thread_t *t, vm_area_struct_t *vma, size_t va) {
+  if (!vma->pages) {
+    return -1;
+  }
+  uint32_t head = (va - vma->virt_addr) / PAGE_SIZE;
+  uint32_t tail = vma->area_size / PAGE_SIZE - head;
+  uint64_t *pages = kmalloc(tail * sizeof(uint64_t), GFP_KERNEL);
+  if (!pages) {
+    return -1;
+  }
+  memcpy(pages, vma->pages + head, tail * sizeof(uint64_t));
+  // the tree summaries depend on the size, so shrink vma out of the tree
+  vma_tree_remove(&t->vma_root, vma);
+  vma->area_size = head * PAGE_SIZE;
+  vma_tree_insert(&t->vma_root, vma);
+  vm_area_struct_t *rest =
+      mmu_add_vma(t, va, tail * PAGE_SIZE, 0, vma->rwx, vma->is_alloced);
+  if (!rest) {
+    vma_tree_remove(&t->vma_root, vma);
+    vma->area_size += tail * PAGE_SIZE;
+    vma_tree_insert(&t->vma_root, vma);
+    kfree(pages);
+    return -1;
+  }
+  rest->pages = pages;
+  rest->vnode = vma->vnode;
+  rest->file_offset = vma->file_offset + head * PAGE_SIZE;
+  rest->map_shared = vma->map_shared;
+  return 0;
+}
+
+// Remove [va, va + len) from t. Areas reaching past either end are cut
+// first. Dirty pages of shared file areas are written back, the entries
+// cleared and the frames released. Returns -1 when an area cannot be cut.
+int mmu_unmap(thread_t *t, size_t va, size_t len) {
+  size_t end = va + len;
+  vm_area_struct_t *vma = vma_tree_find(t->vma_root, va);
+  if (vma && vma->virt_addr < va && mmu_split_vma(t, vma, va)) {
+    return -1;
+  }
+  vma = vma_tree_find(t->vma_root, end - 1);
+  if (vma && vma->virt_addr + vma->area_size > end &&
+      mmu_split_vma(t, vma, end)) {
+    return -1;
+  }
+  size_t *pgd = (size_t *)PHYS_TO_VIRT(t->context.pgd);
+  double_linked_node_t *cur, *n;
+  double_linked_for_each_safe(cur, n, &t->vma_list) {
+    vma = (vm_area_struct_t *)cur;
+    if (vma->virt_addr < va || vma->virt_addr >= end) {
+      continue;
+    }
+    if (vma->map_shared) {
+      page_cache_writeback(vma->vnode, vma->file_offset, vma->area_size);
+    }
+    if (mmu_vma_is_huge(vma)) {
+      size_t *pmd = mmu_find_pmd(pgd, vma->virt_addr);
+      if (pmd) {
+        *pmd = 0;
+      }
+    } else {
+      for (size_t off = 0; off < vma->area_size; off += PAGE_SIZE) {
+        size_t *pte = mmu_find_pte(pgd, vma->virt_addr + off);
+        if (pte) {
+          *pte = 0;
+        }
+      }
+    }
+    tlb_flush_range(t->asid, vma->virt_addr, vma->area_size);
+    if (vma->is_alloced) {
+      mmu_vma_ref(vma, -1);
+    }
+    mmu_remove_vma(t, vma);
+  }
+  return 0;
 }
 
 void mmu_del_vma(thread_t *t) {
-  double_linked_node_t *cur;
-  double_linked_for_each(cur, &t->vma_list) {
+  double_linked_node_t *cur, *n;
+  double_linked_for_each_safe(cur, n, &t->vma_list) {
     vm_area_struct_t *vma = (vm_area_struct_t *)cur;
     if (vma->is_alloced) {
-      int no_ref = 1;
-      for (int i = 0; i < vma->area_size / PAGE_SIZE; ++i) {
-        if (--frame_array[(vma->phys_addr + i * PAGE_SIZE) / PAGE_SIZE].ref) {
-          no_ref = 0;
-        }
+      mmu_vma_ref(vma, -1);
+    }
+    kfree(vma->pages);
+    kmem_cache_free(vma_cache, cur);
+  }
+  double_linked_init(&t->vma_list);
+  t->vma_root = NULL;
+  t->vma_last = NULL;
+}
+
+// Compaction hook: point the user mapping of frame `from` at `to`, which
+// already holds a copy. Movable pages have one owner and sit in the page
+// array of one area.
+int mmu_migrate_page(uint64_t from, uint64_t to) {
+  for (int i = 0; i <= PID_MAX; ++i) {
+    thread_t *t = &thread_table[i];
+    if (t->state != THREAD_READY && t->state != THREAD_RUNNING) {
+      continue;
+    }
+    double_linked_node_t *cur;
+    double_linked_for_each(cur, &t->vma_list) {
+      vm_area_struct_t *vma = (vm_area_struct_t *)cur;
+      if (!vma->pages) {
+        continue;
+      }
+      uint32_t idx = 0;
+      while (idx < vma->area_size / PAGE_SIZE && vma->pages[idx] != from) {
+        idx++;
+      }
+      if (idx == vma->area_size / PAGE_SIZE) {
+        continue;
       }
-      if (no_ref) {
-        buddy_system_free(PHYS_TO_VIRT(vma->phys_addr));
+      vma->pages[idx] = to;
+      size_t va = vma->virt_addr + idx * PAGE_SIZE;
+      // thread_create hands out a virtual PGD until exec converts it
+      uint64_t pgd = (uint64_t)t->context.pgd;
+      pgd = pgd < BUDDY_MEMORY_BASE ? PHYS_TO_VIRT(pgd) : pgd;
+      size_t *pte = mmu_find_pte((size_t *)pgd, va);
+      if (pte && (*pte & ENTRY_ADDR_MASK) == from) {
+        *pte = (*pte & ~ENTRY_ADDR_MASK) | to;
+        tlb_flush_page(t->asid, va);
       }
+      cache_sync_icache_range((char *)PHYS_TO_VIRT(to), PAGE_SIZE);
+      return 0;
     }
-    memory_pool_free((void *)cur, 0);
   }
+  return -1;
 }
 
+// Free the translation tables under page_table. Huge page block entries
+// are only cleared; the memory behind them belongs to the VMAs.
 void mmu_free_page_tables(size_t *page_table, int level) {
   size_t *table_virt = (size_t *)PHYS_TO_VIRT((char *)page_table);
   for (int i = 0; i < 512; ++i) {
     if (table_virt[i] != 0) {
       size_t *next_table = (size_t *)(table_virt[i] & ENTRY_ADDR_MASK);
-      if (table_virt[i] & PD_TABLE) {
+      if ((table_virt[i] & 0b11) == PD_TABLE) {
         if (level != 2)
           mmu_free_page_tables(next_table, level + 1);
-        table_virt[i] = 0L;
         buddy_system_free((uint64_t)PHYS_TO_VIRT((char *)next_table));
       }
+      table_virt[i] = 0L;
     }
   }
 }
 
+// Write fault on a shared huge page: copy it into a 2MB block of our own,
+// or, when none is free, into 512 single pages that back the area instead.
+// Returns -1 when not even those can be had.
+static int mmu_cow_huge(vm_area_struct_t *vma, size_t flag) {
+  size_t *pgd = PHYS_TO_VIRT(current_thread->context.pgd);
+  uint64_t from = vma->phys_addr;
+  uint32_t nr_pages = 1U << HUGE_PAGE_ORDER;
+  if (frame_array[from / PAGE_SIZE].ref == 1) {
+    return map_huge_page(pgd, vma->virt_addr, from, flag);
+  }
+
+  uint64_t block = alloc_huge_page();
+  if (block) {
+    memcpy((char *)block, (char *)PHYS_TO_VIRT(from), HUGE_PAGE_SIZE);
+    cache_sync_icache_range((char *)block, HUGE_PAGE_SIZE);
+    frame_ref_range(from, nr_pages, -1);
+    frame_ref_range(VIRT_TO_PHYS(block), nr_pages, 1);
+    vma->phys_addr = VIRT_TO_PHYS(block);
+    return map_huge_page(pgd, vma->virt_addr, vma->phys_addr, flag);
+  }
+
+  uint64_t *pages = kmalloc(nr_pages * sizeof(uint64_t), GFP_KERNEL);
+  if (!pages || !alloc_pages_bulk(nr_pages, pages, GFP_USER)) {
+    kfree(pages);
+    return -1;
+  }
+  for (uint32_t i = 0; i < nr_pages; ++i) {
+    memcpy((char *)pages[i], (char *)PHYS_TO_VIRT(from + i * PAGE_SIZE),
+           PAGE_SIZE);
+    cache_sync_icache_range((char *)pages[i], PAGE_SIZE);
+  }
+  // the next touch faults the single pages in through a level 3 table
+  size_t *pmd = mmu_find_pmd(pgd, vma->virt_addr);
+  if (pmd) {
+    *pmd = 0;
+  }
+  frame_ref_range(from, nr_pages, -1);
+  // the area stays, now backed by a page array
+  for (uint32_t i = 0; i < nr_pages; ++i) {
+    pages[i] = VIRT_TO_PHYS(pages[i]);
+  }
+  vma->pages = pages;
+  mmu_vma_ref(vma, 1);
+  return 0;
+}
+
 void mmu_memfail_abort_handler(esr_el1_t *esr_el1) {
   uint64_t far_el1;
   __asm__ __volatile__("mrs %0, FAR_EL1" : "=r"(far_el1));
-  uart_sendline("far_el1: 0x%p ", far_el1);
-  double_linked_node_t *cur;
-  vm_area_struct_t *the_area_ptr = NULL;
-  double_linked_for_each(cur, &current_thread->vma_list) {
-    vm_area_struct_t *vma = (vm_area_struct_t *)cur;
-    if (far_el1 >= vma->virt_addr &&
-        far_el1 < (vma->virt_addr + vma->area_size)) {
-      the_area_ptr = vma;
-      break;
-    }
-  }
+  vm_area_struct_t *the_area_ptr = mmu_find_vma(current_thread, far_el1);
 
   // Area is not part of process's address space
   if (!the_area_ptr) {
-    uart_sendline("[Segmentation fault]\n");
+    log_err("[Segmentation fault] far_el1: 0x%p\n", far_el1);
     thread_exit();
     return;
   }
@@ -137,50 +690,167 @@ void mmu_memfail_abort_handler(esr_el1_t *esr_el1) {
                     ? addr_offset
                     : addr_offset - (addr_offset % 0x1000);
 
-  // For translation fault, only map one page frame for the fault address
-  if ((esr_el1->iss & 0x3f) == TF_LEVEL0 ||
-      (esr_el1->iss & 0x3f) == TF_LEVEL1 ||
-      (esr_el1->iss & 0x3f) == TF_LEVEL2 ||
-      (esr_el1->iss & 0x3f) == TF_LEVEL3) {
-    uart_sendline("[Translation fault]\n");
-    map_one_page(PHYS_TO_VIRT(current_thread->context.pgd),
-                 the_area_ptr->virt_addr + addr_offset,
-                 the_area_ptr->phys_addr + addr_offset, flag);
+  if (the_area_ptr->vnode && !the_area_ptr->pages[addr_offset / PAGE_SIZE] &&
+      mmu_fault_in_file(the_area_ptr, addr_offset) != 0) {
+    log_err("[Page fault] far_el1: 0x%p, cannot read page in\n", far_el1);
+    thread_exit();
+    return;
+  }
+
+  uint64_t pa = mmu_vma_phys(the_area_ptr, addr_offset);
+  int write = (esr_el1->ec == MEMFAIL_DATA_ABORT_LOWER ||
+               esr_el1->ec == MEMFAIL_DATA_ABORT_SAME) &&
+              (esr_el1->iss & ISS_WNR);
+  int translation = (esr_el1->iss & 0x3f) == TF_LEVEL0 ||
+                    (esr_el1->iss & 0x3f) == TF_LEVEL1 ||
+                    (esr_el1->iss & 0x3f) == TF_LEVEL2 ||
+                    (esr_el1->iss & 0x3f) == TF_LEVEL3;
+
+  // A shared file mapping stays on the page cache's own page. It is mapped
+  // read-only until the first store, which marks the page dirty.
+  if (the_area_ptr->map_shared) {
+    if ((write && !(the_area_ptr->rwx & 0b10)) || (!translation && !write)) {
+      log_err("[Permission fault] far_el1: 0x%p\n", far_el1);
+      thread_exit();
+      return;
+    }
+    if (write && page_cache_dirty(the_area_ptr->vnode,
+                                  the_area_ptr->file_offset + addr_offset)) {
+      log_err("[Permission fault] far_el1: 0x%p, read-only file\n", far_el1);
+      thread_exit();
+      return;
+    }
+    if (!write) {
+      flag |= PD_RDONLY;
+    }
+    if (map_one_page(PHYS_TO_VIRT(current_thread->context.pgd),
+                     the_area_ptr->virt_addr + addr_offset, pa, flag) != 0) {
+      log_err("[Page fault] far_el1: 0x%p, out of memory\n", far_el1);
+      thread_exit();
+      return;
+    }
+    tlb_flush_page(current_thread->asid, the_area_ptr->virt_addr + addr_offset);
+    return;
+  }
+
+  // A frame still shared since fork is mapped read-only, unless this very
+  // access is a write, which copies it right away.
+  int shared =
+      the_area_ptr->is_alloced && frame_array[pa / PAGE_SIZE].ref > 1;
+  int cow_now = shared && (the_area_ptr->rwx & 0b10) && write;
+
+  // For translation fault, only map one page frame for the fault address.
+  // Invalid entries are never cached, so there is nothing to invalidate,
+  // except a level 3 table the huge page replaces.
+  if (!cow_now && translation) {
+    log_debug("[Translation fault] far_el1: 0x%p\n", far_el1);
+    if (shared) {
+      flag |= PD_RDONLY;
+    }
+    int ret;
+    if (mmu_vma_is_huge(the_area_ptr)) {
+      ret = map_huge_page(PHYS_TO_VIRT(current_thread->context.pgd),
+                          the_area_ptr->virt_addr, the_area_ptr->phys_addr,
+                          flag);
+      tlb_flush_page(current_thread->asid, the_area_ptr->virt_addr);
+    } else {
+      ret = map_one_page(PHYS_TO_VIRT(current_thread->context.pgd),
+                         the_area_ptr->virt_addr + addr_offset, pa, flag);
+    }
+    if (ret != 0) {
+      log_err("[Page fault] far_el1: 0x%p, out of memory\n", far_el1);
+      thread_exit();
+    }
   } else {
-    if (esr_el1->iss & 0b001111) {
-      if (the_area_ptr->rwx & 0b10) {
-        uart_sendline("[Copy on Write]\n");
-        uart_sendline(
-            "ref count: 0x%d\n",
-            frame_array[(the_area_ptr->phys_addr + addr_offset) / PAGE_SIZE]
-                .ref);
-        if (frame_array[(the_area_ptr->phys_addr + addr_offset) / PAGE_SIZE]
-                .ref > 1) {
-          frame_array[(the_area_ptr->phys_addr + addr_offset) / PAGE_SIZE]
-              .ref--;
-          size_t new_page = buddy_system_allocator(PAGE_SIZE);
+    if (cow_now || (esr_el1->iss & 0b001111)) {
+      if ((the_area_ptr->rwx & 0b10) && mmu_vma_is_huge(the_area_ptr)) {
+        log_debug("[Copy on Write] far_el1: 0x%p, huge page\n", far_el1);
+        if (mmu_cow_huge(the_area_ptr, flag) != 0) {
+          log_err("[Copy on Write] far_el1: 0x%p, out of memory\n", far_el1);
+          thread_exit();
+          return;
+        }
+        tlb_flush_page(current_thread->asid, the_area_ptr->virt_addr);
+      } else if (the_area_ptr->rwx & 0b10) {
+        if (the_area_ptr->pages && frame_array[pa / PAGE_SIZE].ref > 1) {
+          log_debug("[Copy on Write] far_el1: 0x%p, ref count: %d\n",
+                    far_el1, frame_array[pa / PAGE_SIZE].ref);
+          uint64_t new_page;
+          if (!alloc_pages_bulk(1, &new_page, GFP_USER)) {
+            log_err("[Copy on Write] far_el1: 0x%p, out of memory\n",
+                    far_el1);
+            thread_exit();
+            return;
+          }
+          frame_array[pa / PAGE_SIZE].ref--;
           frame_array[VIRT_TO_PHYS(new_page) / PAGE_SIZE].ref++;
-          memcpy((char *)new_page,
-                 (char *)PHYS_TO_VIRT(the_area_ptr->phys_addr + addr_offset),
-                 PAGE_SIZE);
-          the_area_ptr->phys_addr = VIRT_TO_PHYS(new_page);
-          map_one_page(PHYS_TO_VIRT(current_thread->context.pgd),
-                       the_area_ptr->virt_addr + addr_offset,
-                       the_area_ptr->phys_addr + addr_offset, flag);
-        } else {
-          map_one_page(PHYS_TO_VIRT(current_thread->context.pgd),
-                       the_area_ptr->virt_addr + addr_offset,
-                       the_area_ptr->phys_addr + addr_offset, flag);
+          memcpy((char *)new_page, (char *)PHYS_TO_VIRT(pa), PAGE_SIZE);
+          cache_sync_icache_range((char *)new_page, PAGE_SIZE);
+          pa = VIRT_TO_PHYS(new_page);
+          the_area_ptr->pages[addr_offset / PAGE_SIZE] = pa;
+        }
+        if (map_one_page(PHYS_TO_VIRT(current_thread->context.pgd),
+                         the_area_ptr->virt_addr + addr_offset, pa,
+                         flag) != 0) {
+          log_err("[Page fault] far_el1: 0x%p, out of memory\n", far_el1);
+          thread_exit();
+          return;
         }
+        tlb_flush_page(current_thread->asid,
+                       the_area_ptr->virt_addr + addr_offset);
       } else {
-        uart_sendline("[Permission fault]\n");
+        log_err("[Permission fault] far_el1: 0x%p\n", far_el1);
         thread_exit();
       }
     } else {
-      uart_sendline("[Other fault]\n");
+      log_err("[Other fault] far_el1: 0x%p\n", far_el1);
       thread_exit();
     }
   }
-  asm("tlbi vmalle1is");
-  asm("dsb ish");
-}
\ No newline at end of file
+}
+
+// Leave the boot tables: their identity mapping of the low half is global
+// and would shadow user mappings of any ASID. Nothing after thread_init
+// touches low addresses, so an empty table with ASID 0 takes their place.
+void mmu_asid_init(void *empty_pgd) {
+  asid_reserved_ttbr0 = (uint64_t)empty_pgd & TTBR_BADDR_MASK;
+  asm volatile("dsb ish\n"
+               "msr ttbr0_el1, %0\n"
+               "isb\n"
+               "tlbi vmalle1is\n"
+               "dsb ish\n"
+               "isb\n" ::"r"(asid_reserved_ttbr0));
+}
+
+// ASIDs carry a generation in the bits above ASID_BITS. One that is not of
+// the current generation is replaced; once the ASID space runs out, a new
+// generation starts with a single full flush and every thread picks up a
+// fresh ASID on its next switch.
+uint64_t mmu_asid(uint64_t *asid) {
+  lock();
+  if ((*asid & ~ASID_MASK) != asid_generation) {
+    if (asid_next > ASID_MASK) {
+      asid_generation += 1UL << ASID_BITS;
+      asid_next = 1;
+      asid_rollovers++;
+      // the running thread's old ASID may be handed out again
+      asm volatile("dsb ish\n"
+                   "msr ttbr0_el1, %0\n"
+                   "isb\n"
+                   "tlbi vmalle1is\n"
+                   "dsb ish\n"
+                   "isb\n" ::"r"(asid_reserved_ttbr0));
+    }
+    *asid = asid_generation | asid_next++;
+  }
+  unlock();
+  return *asid & ASID_MASK;
+}
+
+// The ttbr0_el1 value that switches to t's address space. The pgd of a
+// thread that never went through exec is still a kernel virtual address.
+uint64_t mmu_ttbr0(thread_t *t) {
+  uint64_t asid = mmu_asid(&t->asid);
+  return ((uint64_t)t->context.pgd & TTBR_BADDR_MASK) |
+         (asid << TTBR_ASID_SHIFT);
+}
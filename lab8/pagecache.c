@@ -0,0 +1,226 @@
+#include "include/pagecache.h"
+#include "include/allocator.h"
+#include "include/buddy_system.h"
+#include "include/cache.h"
+#include "include/exception.h"
+#include "include/heap.h"
+#include "include/mmu.h"
+#include "include/shrinker.h"
+#include "include/types.h"
+#include "include/utils.h"
+
+extern double_linked_node_t *page_cache_list;
+extern frame_array_node_t frame_array[];
+
+static uint32_t page_cache_shrink_count();
+static uint32_t page_cache_shrink_scan(uint32_t nr_pages);
+
+void page_cache_init() {
+  page_cache_list = simple_malloc(sizeof(double_linked_node_t), 0);
+  double_linked_init(page_cache_list);
+  register_shrinker("page cache", page_cache_shrink_count,
+                    page_cache_shrink_scan);
+}
+
+static page_cache_t *page_cache_create(vnode_t *vnode) {
+  long size = vnode->f_ops->getsize(vnode);
+  if (size < 0) {
+    return NULL;
+  }
+  page_cache_t *pc = kmalloc(sizeof(page_cache_t), GFP_KERNEL);
+  if (!pc) {
+    return NULL;
+  }
+  pc->vnode = vnode;
+  pc->nr_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+  pc->pages = kmalloc(pc->nr_pages * sizeof(uint64_t), GFP_KERNEL | __GFP_ZERO);
+  if (!pc->pages && pc->nr_pages) {
+    kfree(pc);
+    return NULL;
+  }
+  double_linked_add_before((double_linked_node_t *)pc, page_cache_list);
+  vnode->page_cache = pc;
+  return pc;
+}
+
+// Bring the page at offset into the cache: in place when the filesystem
+// can map it, otherwise read into a fresh page (zero past the end).
+static uint64_t page_cache_fill(vnode_t *vnode, size_t offset) {
+  uint64_t pa = 0;
+  if (vnode->f_ops->map_page) {
+    pa = vnode->f_ops->map_page(vnode, offset);
+  }
+  if (pa) {
+    frame_array[pa / PAGE_SIZE].ref++;
+    return pa | PAGE_CACHE_DIRECT;
+  }
+  uint64_t page;
+  if (!alloc_pages_bulk(1, &page, GFP_KERNEL | __GFP_ZERO)) {
+    return 0;
+  }
+  file_t f = {.vnode = vnode, .f_pos = offset, .f_ops = vnode->f_ops};
+  vnode->f_ops->read(&f, (void *)page, PAGE_SIZE);
+  cache_sync_icache_range((char *)page, PAGE_SIZE);
+  frame_array[VIRT_TO_PHYS(page) / PAGE_SIZE].ref++;
+  return VIRT_TO_PHYS(page);
+}
+
+// The file may have grown since its cache was set up: widen pages[] to
+// cover page idx, or return -1 if the file does not reach it.
+static int page_cache_grow(page_cache_t *pc, uint32_t idx) {
+  long size = pc->vnode->f_ops->getsize(pc->vnode);
+  uint32_t nr_pages = size > 0 ? (size + PAGE_SIZE - 1) / PAGE_SIZE : 0;
+  if (idx >= nr_pages) {
+    return -1;
+  }
+  uint64_t *pages =
+      kmalloc(nr_pages * sizeof(uint64_t), GFP_KERNEL | __GFP_ZERO);
+  if (!pages) {
+    return -1;
+  }
+  memcpy(pages, pc->pages, pc->nr_pages * sizeof(uint64_t));
+  kfree(pc->pages);
+  pc->pages = pages;
+  pc->nr_pages = nr_pages;
+  return 0;
+}
+
+// Physical address of the page at offset (page-aligned) of vnode, with a
+// reference taken for the caller's mapping. Returns 0 past the end of the
+// file or when out of memory.
+uint64_t page_cache_get(vnode_t *vnode, size_t offset) {
+  lock();
+  page_cache_t *pc = vnode->page_cache;
+  if (!pc) {
+    pc = page_cache_create(vnode);
+  }
+  uint32_t idx = offset / PAGE_SIZE;
+  if (!pc || (idx >= pc->nr_pages && page_cache_grow(pc, idx))) {
+    unlock();
+    return 0;
+  }
+  if (!pc->pages[idx]) {
+    pc->pages[idx] = page_cache_fill(vnode, offset);
+  }
+  uint64_t pa = pc->pages[idx] & ~PAGE_CACHE_FLAGS;
+  if (pa) {
+    frame_array[pa / PAGE_SIZE].ref++;
+  }
+  unlock();
+  return pa;
+}
+
+// A shared mapping is about to store to the page at offset. Returns -1 for
+// a page that is the file itself: it may only ever be mapped read-only.
+int page_cache_dirty(vnode_t *vnode, size_t offset) {
+  page_cache_t *pc = vnode->page_cache;
+  uint32_t idx = offset / PAGE_SIZE;
+  if (!pc || idx >= pc->nr_pages || !pc->pages[idx]) {
+    return 0;
+  }
+  if (pc->pages[idx] & PAGE_CACHE_DIRECT) {
+    return -1;
+  }
+  pc->pages[idx] |= PAGE_CACHE_DIRTY;
+  return 0;
+}
+
+// Keep the cached copies in step with len bytes written to the file at pos.
+void page_cache_write(vnode_t *vnode, size_t pos, const void *buf,
+                      size_t len) {
+  lock();
+  page_cache_t *pc = vnode->page_cache;
+  while (pc && len && pos / PAGE_SIZE < pc->nr_pages) {
+    uint64_t page = pc->pages[pos / PAGE_SIZE];
+    size_t off = pos % PAGE_SIZE;
+    size_t n = PAGE_SIZE - off < len ? PAGE_SIZE - off : len;
+    if (page && !(page & PAGE_CACHE_DIRECT)) {
+      memcpy((char *)PHYS_TO_VIRT((page & ~PAGE_CACHE_FLAGS)) + off, buf, n);
+    }
+    pos += n;
+    buf = (const char *)buf + n;
+    len -= n;
+  }
+  unlock();
+}
+
+// Write the dirty pages of [offset, offset + len) of the file back through
+// its filesystem, never past the end of the file. Each page is made
+// read-only in every mapping first, so the next store marks it dirty
+// again. Returns -1 when the filesystem refuses a write.
+int page_cache_writeback(vnode_t *vnode, size_t offset, size_t len) {
+  lock();
+  page_cache_t *pc = vnode->page_cache;
+  if (!pc) {
+    unlock();
+    return 0;
+  }
+  long size = vnode->f_ops->getsize(vnode);
+  uint32_t end = (offset + len + PAGE_SIZE - 1) / PAGE_SIZE;
+  end = end < pc->nr_pages ? end : pc->nr_pages;
+  int ret = 0;
+  for (uint32_t i = offset / PAGE_SIZE; i < end; ++i) {
+    if (!(pc->pages[i] & PAGE_CACHE_DIRTY)) {
+      continue;
+    }
+    uint64_t pa = pc->pages[i] & ~PAGE_CACHE_FLAGS;
+    mmu_wrprotect_page(pa);
+    pc->pages[i] = pa;
+    long pos = (long)i * PAGE_SIZE;
+    if (pos >= size) {
+      continue;
+    }
+    long n = size - pos < PAGE_SIZE ? size - pos : PAGE_SIZE;
+    file_t f = {.vnode = vnode, .f_pos = pos, .f_ops = vnode->f_ops};
+    if (vnode->f_ops->write(&f, (void *)PHYS_TO_VIRT(pa), n) != n) {
+      ret = -1;
+    }
+  }
+  unlock();
+  return ret;
+}
+
+void page_cache_sync() {
+  double_linked_node_t *cur;
+  double_linked_for_each(cur, page_cache_list) {
+    page_cache_t *pc = (page_cache_t *)cur;
+    page_cache_writeback(pc->vnode, 0, (size_t)pc->nr_pages * PAGE_SIZE);
+  }
+}
+
+// Clean pages only the cache itself still references.
+static int page_cache_idle(uint64_t page) {
+  return page && !(page & PAGE_CACHE_FLAGS) &&
+         frame_array[page / PAGE_SIZE].ref == 1;
+}
+
+static uint32_t page_cache_shrink_count() {
+  uint32_t count = 0;
+  double_linked_node_t *cur;
+  double_linked_for_each(cur, page_cache_list) {
+    page_cache_t *pc = (page_cache_t *)cur;
+    for (uint32_t i = 0; i < pc->nr_pages; ++i) {
+      count += page_cache_idle(pc->pages[i]);
+    }
+  }
+  return count;
+}
+
+static uint32_t page_cache_shrink_scan(uint32_t nr_pages) {
+  uint32_t freed = 0;
+  double_linked_node_t *cur;
+  double_linked_for_each(cur, page_cache_list) {
+    page_cache_t *pc = (page_cache_t *)cur;
+    for (uint32_t i = 0; i < pc->nr_pages && freed < nr_pages; ++i) {
+      if (!page_cache_idle(pc->pages[i])) {
+        continue;
+      }
+      frame_array[pc->pages[i] / PAGE_SIZE].ref--;
+      uint64_t page = PHYS_TO_VIRT(pc->pages[i]);
+      free_pages_bulk(1, &page);
+      pc->pages[i] = 0;
+      freed++;
+    }
+  }
+  return freed;
+}
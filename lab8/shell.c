@@ -1,15 +1,22 @@
 #include "include/shell.h"
+#include "include/alloc_profile.h"
 #include "include/allocator.h"
 #include "include/buddy_system.h"
 #include "include/cpio.h"
 #include "include/dtb.h"
 #include "include/exception.h"
 #include "include/heap.h"
+#include "include/log.h"
 #include "include/mbox.h"
+#include "include/membench.h"
+#include "include/meminfo.h"
 #include "include/mmu.h"
 #include "include/power.h"
+#include "include/shrinker.h"
+#include "include/slab.h"
 #include "include/thread.h"
 #include "include/timer.h"
+#include "include/tlbbench.h"
 #include "include/types.h"
 #include "include/uart.h"
 #include "include/utils.h"
@@ -130,6 +137,43 @@ void shell_run() {
     } else if (strcmp(token, "freelist") == 0) {
       char *show_bitmap = strtok(NULL, " ", &saveptr);
       do_cmd_freelist(atoi(show_bitmap));
+    } else if (strcmp(token, "buddystat") == 0) {
+      do_cmd_buddystat();
+    } else if (strcmp(token, "magazine") == 0) {
+      char *level = strtok(NULL, " ", &saveptr);
+      char *low = strtok(NULL, " ", &saveptr);
+      char *high = strtok(NULL, " ", &saveptr);
+      if (level && low && high) {
+        do_cmd_magazine(atoi(level), atoi(low), atoi(high));
+      } else {
+        uart_sendline("Usage: magazine <level> <low> <high>\n");
+      }
+    } else if (strcmp(token, "slabinfo") == 0) {
+      do_cmd_slabinfo();
+    } else if (strcmp(token, "meminfo") == 0) {
+      do_cmd_meminfo();
+    } else if (strcmp(token, "allocprof") == 0) {
+      do_cmd_allocprof();
+    } else if (strcmp(token, "membench") == 0) {
+      do_cmd_membench();
+    } else if (strcmp(token, "tlbbench") == 0) {
+      do_cmd_tlbbench();
+    } else if (strcmp(token, "dmesg") == 0) {
+      do_cmd_dmesg();
+    } else if (strcmp(token, "loglevel") == 0) {
+      char *level = strtok(NULL, " ", &saveptr);
+      if (level) {
+        do_cmd_loglevel(atoi(level));
+      } else {
+        uart_sendline("Usage: loglevel <0-3>\n");
+      }
+    } else if (strcmp(token, "compact") == 0) {
+      char *order = strtok(NULL, " ", &saveptr);
+      if (order) {
+        do_cmd_compact(atoi(order));
+      } else {
+        uart_sendline("Usage: compact <order>\n");
+      }
     } else if (strcmp(token, "malloc") == 0) {
       char *size = strtok(NULL, " ", &saveptr);
       do_cmd_malloc(atoi(size));
@@ -197,6 +241,17 @@ void do_cmd_help() {
   format_command(" preempt", "Test preemptive IRQ.");
   format_command(" freelist [show_bitmap]",
                  "Show buddy system free lists and bitmap.");
+  format_command(" buddystat", "Show buddy system latency counters.");
+  format_command(" magazine <level> <low> <high>",
+                 "Set page magazine watermarks.");
+  format_command(" slabinfo", "Show object cache utilization.");
+  format_command(" meminfo", "Show allocator counters and fragmentation.");
+  format_command(" allocprof", "Show live memory by allocation site.");
+  format_command(" membench", "Measure memcpy/memset bytes per cycle.");
+  format_command(" tlbbench", "Measure TLB refills after a context switch.");
+  format_command(" dmesg", "Show the kernel log.");
+  format_command(" loglevel <0-3>", "Set the console log level.");
+  format_command(" compact <order>", "Migrate user pages to free a block.");
   format_command(" malloc <size>", "Allocate memory.");
   format_command(" free <frame_index>", "Free buddy system memory.");
   format_command(" sfree <address>", "Free memory pool address.");
@@ -271,6 +326,49 @@ void do_cmd_freelist(int show_bitmap) {
   buddy_system_print_freelists(show_bitmap);
 }
 
+void do_cmd_buddystat() {
+  buddy_system_print_stats();
+  shrinker_print_info();
+}
+
+void do_cmd_magazine(int level, int low, int high) {
+  if (buddy_system_magazine_set_watermark(level, low, high) != 0) {
+    uart_sendline("Invalid magazine watermark.\n");
+  }
+}
+
+void do_cmd_slabinfo() { kmem_cache_print_info(); }
+
+void do_cmd_meminfo() { meminfo_print(); }
+
+void do_cmd_allocprof() { alloc_profile_print(); }
+
+void do_cmd_membench() { membench_run(); }
+
+void do_cmd_tlbbench() { tlbbench_run(); }
+
+void do_cmd_dmesg() { log_dmesg(); }
+
+void do_cmd_loglevel(int level) {
+  if (level < LOG_ERR || level > LOG_DEBUG) {
+    uart_sendline("Invalid log level.\n");
+    return;
+  }
+  log_set_console_level(level);
+}
+
+void do_cmd_compact(int order) {
+  if (order <= 0 || order > MAX_LEVEL) {
+    uart_sendline("Invalid order.\n");
+    return;
+  }
+  if (buddy_system_compact(order) == 0) {
+    uart_sendline("[Compaction] Order %d block available.\n", order);
+  } else {
+    uart_sendline("[Compaction] Could not free an order %d block.\n", order);
+  }
+}
+
 void do_cmd_malloc(unsigned int size) {
   if (size == 0 || size > (1 << MAX_LEVEL) * PAGE_SIZE) {
     uart_sendline("Invalid allocation size.\n");
@@ -299,12 +397,15 @@ void do_cmd_sfree(unsigned long addr) {
 }
 
 void do_cmd_exec(const char *progname) {
-  char *progdata = cpio_get_file_data(progname);
-  unsigned long progsize = cpio_get_file_size(progname);
-  if (progdata == NULL) {
+  char path[MAX_PATH_NAME];
+  strcpy(path, "/initramfs/");
+  strcat(path, progname);
+  vnode_t *file;
+  if (vfs_lookup(path, &file) != 0) {
+    uart_sendline("exec: %s: No such file\n", progname);
     return;
   }
-  exec_thread(progdata, progsize);
+  exec_thread(file);
 }
 
 void do_cmd_thread() {
@@ -358,11 +459,12 @@ void back_to_kernel(char *arg) {
 }
 
 void do_cmd_dev_uart(const char *msg) {
-  file_t *f = memory_pool_allocator(sizeof(file_t), 0);
+  file_t *f;
   vfs_open("/dev/uart", 0, &f);
   char *buf = memory_pool_allocator(strlen(msg) + 3, 0);
   strcpy(buf, msg);
   strcat(buf, "\r\n");
   f->f_ops->write(f, buf, strlen(buf));
   vfs_close(f);
+  memory_pool_free(buf, 0);
 }
\ No newline at end of file
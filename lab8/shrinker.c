@@ -0,0 +1,60 @@
+#include "include/shrinker.h"
+#include "include/exception.h"
+#include "include/types.h"
+#include "include/uart.h"
+
+extern shrinker_t shrinkers[];
+extern int shrinking;
+
+int register_shrinker(const char *name, uint32_t (*count)(),
+                      uint32_t (*scan)(uint32_t nr_pages)) {
+  for (int i = 0; i < MAX_SHRINKER_REG; ++i) {
+    if (!shrinkers[i].name) {
+      shrinkers[i].name = name;
+      shrinkers[i].count = count;
+      shrinkers[i].scan = scan;
+      shrinkers[i].calls = 0;
+      shrinkers[i].freed = 0;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Ask the registered caches for nr_pages, in registration order. Shrinkers
+// free memory through the allocators themselves, so a nested request from
+// inside a scan is ignored rather than recursing.
+uint32_t shrink_memory(uint32_t nr_pages) {
+  lock();
+  if (shrinking) {
+    unlock();
+    return 0;
+  }
+  shrinking = 1;
+  uint32_t freed = 0;
+  for (int i = 0; i < MAX_SHRINKER_REG && freed < nr_pages; ++i) {
+    shrinker_t *s = &shrinkers[i];
+    if (!s->name || s->count() == 0) {
+      continue;
+    }
+    uint32_t n = s->scan(nr_pages - freed);
+    s->calls++;
+    s->freed += n;
+    freed += n;
+  }
+  shrinking = 0;
+  unlock();
+  return freed;
+}
+
+void shrinker_print_info() {
+  for (int i = 0; i < MAX_SHRINKER_REG; ++i) {
+    shrinker_t *s = &shrinkers[i];
+    if (!s->name) {
+      continue;
+    }
+    uart_sendline("[Shrinker] %s: %u reclaimable pages, %l calls, %l pages "
+                  "freed\n",
+                  s->name, s->count(), s->calls, s->freed);
+  }
+}
@@ -1,6 +1,7 @@
 #include "include/signal.h"
 #include "include/buddy_system.h"
 #include "include/exception.h"
+#include "include/log.h"
 #include "include/syscall.h"
 #include "include/thread.h"
 #include "include/types.h"
@@ -35,8 +36,8 @@ void check_signal(trapframe_t *tpf) {
 void run_signal(trapframe_t *tpf, int signal) {
   current_thread->current_signal_handler =
       current_thread->signal_handler[signal];
-  uart_sendline("signal_handler_wrapper: 0x%p\nhandler: 0x%p\n",
-                signal_handler_wrapper, current_thread->current_signal_handler);
+  log_debug("signal_handler_wrapper: 0x%p, handler: 0x%p\n",
+            signal_handler_wrapper, current_thread->current_signal_handler);
   if (current_thread->current_signal_handler == signal_default_handler) {
     signal_default_handler();
     return;
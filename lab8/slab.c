@@ -0,0 +1,214 @@
+#include "include/slab.h"
+#include "include/alloc_profile.h"
+#include "include/alloc_trace.h"
+#include "include/buddy_system.h"
+#include "include/exception.h"
+#include "include/heap.h"
+#include "include/types.h"
+#include "include/uart.h"
+#include "include/utils.h"
+
+extern kmem_cache_t kmem_caches[];
+extern uint32_t kmem_cache_count;
+extern frame_array_node_t frame_array[];
+
+static inline uint32_t kmem_cache_frame_of(void *object) {
+  return ((uint64_t)object - BUDDY_MEMORY_BASE) / PAGE_SIZE;
+}
+
+// Slabs are naturally aligned buddy blocks, so the head frame of a
+// multi-page slab is found by rounding any of its frames down.
+static inline uint32_t kmem_cache_slab_of(kmem_cache_t *cache, void *object) {
+  uint32_t pages = cache->slab_size / PAGE_SIZE;
+  return kmem_cache_frame_of(object) & ~(pages - 1);
+}
+
+static inline void kmem_cache_slab_mark(kmem_cache_t *cache, uint32_t slab,
+                                        int set) {
+  for (uint32_t i = 0; i < cache->slab_size / PAGE_SIZE; ++i) {
+    if (set) {
+      frame_array[slab + i].flags |= FRAME_SLAB;
+      frame_array[slab + i].cache = cache - kmem_caches;
+    } else {
+      frame_array[slab + i].flags &= ~FRAME_SLAB;
+    }
+  }
+}
+
+static inline char *kmem_cache_slab_base(uint32_t slab) {
+  return (char *)(BUDDY_MEMORY_BASE + (uint64_t)slab * PAGE_SIZE);
+}
+
+static inline void kmem_cache_slab_move(uint32_t slab, uint32_t *from,
+                                        uint32_t *to) {
+  frame_list_remove(from, slab);
+  frame_list_add(to, slab);
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t object_size) {
+  if (kmem_cache_count >= KMEM_CACHE_MAX || object_size == 0 ||
+      object_size > KMEM_SLAB_MAX_SIZE / KMEM_SLAB_MIN_OBJECTS) {
+    uart_sendline("[Slab Error] Cannot create cache %s.\n", name);
+    return NULL;
+  }
+  kmem_cache_t *cache = &kmem_caches[kmem_cache_count++];
+  uint32_t len = strlen(name);
+  len = len > KMEM_CACHE_NAME_MAX ? KMEM_CACHE_NAME_MAX : len;
+  memcpy(cache->name, name, len);
+  cache->name[len] = '\0';
+  cache->object_size =
+      align_size(object_size + ALLOC_PROFILE_TAG_SIZE, KMEM_CACHE_ALIGN);
+  cache->slab_size = PAGE_SIZE;
+  while (cache->slab_size / cache->object_size < KMEM_SLAB_MIN_OBJECTS &&
+         cache->slab_size < KMEM_SLAB_MAX_SIZE) {
+    cache->slab_size <<= 1;
+  }
+  cache->objects_per_slab = cache->slab_size / cache->object_size;
+  cache->slabs_partial = FRAME_NONE;
+  cache->slabs_full = FRAME_NONE;
+  cache->slabs_empty = FRAME_NONE;
+  cache->partial_count = 0;
+  cache->full_count = 0;
+  cache->empty_count = 0;
+  cache->active_objects = 0;
+  cache->alloc_count = 0;
+  cache->free_count = 0;
+  return cache;
+}
+
+// Carve a fresh buddy block into objects chained by their offsets.
+static uint32_t kmem_cache_grow(kmem_cache_t *cache) {
+  uint64_t base = buddy_system_allocator(cache->slab_size);
+  if (!base) {
+    return FRAME_NONE;
+  }
+  uint32_t slab = kmem_cache_frame_of((void *)base);
+  uint32_t offset = 0;
+  for (uint32_t i = 0; i + 1 < cache->objects_per_slab; ++i) {
+    *(uint16_t *)(base + offset) = offset + cache->object_size;
+    alloc_profile_clear((void *)(base + offset), cache->object_size);
+    offset += cache->object_size;
+  }
+  *(uint16_t *)(base + offset) = KMEM_FREELIST_END;
+  alloc_profile_clear((void *)(base + offset), cache->object_size);
+  kmem_cache_slab_mark(cache, slab, 1);
+  frame_array[slab].freelist = 0;
+  frame_array[slab].ref = 0;
+  frame_list_add(&cache->slabs_partial, slab);
+  cache->partial_count++;
+  return slab;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+  lock();
+  uint32_t slab = cache->slabs_partial;
+  if (slab == FRAME_NONE && cache->slabs_empty != FRAME_NONE) {
+    slab = cache->slabs_empty;
+    kmem_cache_slab_move(slab, &cache->slabs_empty, &cache->slabs_partial);
+    cache->empty_count--;
+    cache->partial_count++;
+  } else if (slab == FRAME_NONE) {
+    alloc_trace_enter();
+    alloc_profile_enter();
+    slab = kmem_cache_grow(cache);
+    alloc_profile_exit();
+    alloc_trace_exit();
+    if (slab == FRAME_NONE) {
+      uart_sendline("[Slab Error] Cache %s out of memory.\n", cache->name);
+      unlock();
+      return NULL;
+    }
+  }
+
+  frame_array_node_t *frame = &frame_array[slab];
+  char *object = kmem_cache_slab_base(slab) + frame->freelist;
+  frame->freelist = *(uint16_t *)object;
+  frame->ref++;
+  if (frame->ref == cache->objects_per_slab) {
+    kmem_cache_slab_move(slab, &cache->slabs_partial, &cache->slabs_full);
+    cache->partial_count--;
+    cache->full_count++;
+  }
+  cache->active_objects++;
+  cache->alloc_count++;
+  alloc_trace("S %s %u 0x%p\n", cache->name, cache->object_size, object);
+  alloc_profile_tag(object, cache->object_size - ALLOC_PROFILE_TAG_SIZE,
+                    alloc_profile_caller());
+  unlock();
+  return object;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *object) {
+  lock();
+  uint32_t slab = kmem_cache_slab_of(cache, object);
+  frame_array_node_t *frame = &frame_array[slab];
+  if (!(frame->flags & FRAME_SLAB) || &kmem_caches[frame->cache] != cache ||
+      frame->ref == 0) {
+    uart_sendline("[Slab Error] Bad free of 0x%p in cache %s.\n", object,
+                  cache->name);
+    unlock();
+    return;
+  }
+
+  alloc_trace("s %s 0x%p\n", cache->name, object);
+  alloc_profile_untag(object);
+  *(uint16_t *)object = frame->freelist;
+  frame->freelist = (char *)object - kmem_cache_slab_base(slab);
+  if (frame->ref == cache->objects_per_slab) {
+    kmem_cache_slab_move(slab, &cache->slabs_full, &cache->slabs_partial);
+    cache->full_count--;
+    cache->partial_count++;
+  }
+  frame->ref--;
+  if (frame->ref == 0) {
+    cache->partial_count--;
+    if (cache->empty_count < KMEM_CACHE_EMPTY_MAX) {
+      kmem_cache_slab_move(slab, &cache->slabs_partial, &cache->slabs_empty);
+      cache->empty_count++;
+    } else {
+      frame_list_remove(&cache->slabs_partial, slab);
+      kmem_cache_slab_mark(cache, slab, 0);
+      alloc_trace_enter();
+      alloc_profile_enter();
+      buddy_system_free((uint64_t)kmem_cache_slab_base(slab));
+      alloc_profile_exit();
+      alloc_trace_exit();
+    }
+  }
+  cache->active_objects--;
+  cache->free_count++;
+  unlock();
+}
+
+kmem_cache_t *kmem_cache_of(void *object) {
+  if ((uint64_t)object < BUDDY_MEMORY_BASE ||
+      (uint64_t)object >= BUDDY_MEMORY_BASE + TOTAL_MEMORY) {
+    return NULL;
+  }
+  frame_array_node_t *frame = &frame_array[kmem_cache_frame_of(object)];
+  if (!(frame->flags & FRAME_SLAB)) {
+    return NULL;
+  }
+  return &kmem_caches[frame->cache];
+}
+
+void kmem_cache_print_info() {
+  uart_sendline("name                    objsize objs/slab active  total  "
+                "slabs(p/f/e) util\n");
+  for (uint32_t i = 0; i < kmem_cache_count; ++i) {
+    kmem_cache_t *cache = &kmem_caches[i];
+    uint32_t slabs =
+        cache->partial_count + cache->full_count + cache->empty_count;
+    uint64_t total = (uint64_t)slabs * cache->objects_per_slab;
+    uint64_t used_bytes = cache->active_objects * cache->object_size;
+    uint64_t slab_bytes = (uint64_t)slabs * cache->slab_size;
+    uart_sendline("%s", cache->name);
+    for (int pad = strlen(cache->name); pad < 24; ++pad) {
+      uart_sendline(" ");
+    }
+    uart_sendline("%u\t%u\t  %l\t %l\t%u/%u/%u\t%l%%\n", cache->object_size,
+                  cache->objects_per_slab, cache->active_objects, total,
+                  cache->partial_count, cache->full_count, cache->empty_count,
+                  slab_bytes ? used_bytes * 100 / slab_bytes : 0);
+  }
+}
@@ -1,13 +1,18 @@
 #include "include/syscall.h"
 #include "include/allocator.h"
 #include "include/buddy_system.h"
+#include "include/cache.h"
 #include "include/cpio.h"
 #include "include/dev_framebuffer.h"
 #include "include/exception.h"
+#include "include/log.h"
 #include "include/mbox.h"
 #include "include/mmu.h"
+#include "include/pagecache.h"
 #include "include/signal.h"
+#include "include/slab.h"
 #include "include/thread.h"
+#include "include/tlb.h"
 #include "include/types.h"
 #include "include/uart.h"
 #include "include/utils.h"
@@ -18,6 +23,7 @@ extern volatile unsigned int mbox[];
 extern frame_array_node_t frame_array[];
 extern unsigned int width, height, pitch, isrgb;
 extern uint32_t thread_count;
+extern kmem_cache_t *file_cache;
 
 int getpid(trapframe_t *tpf) {
   tpf->x0 = current_thread->pid;
@@ -45,7 +51,7 @@ size_t uartwrite(trapframe_t *tpf, const char buf[], size_t size) {
 }
 
 int exec(trapframe_t *tpf, const char *name, char *const argv[]) {
-  uart_sendline("exec: name = %s\n", name);
+  log_debug("exec: name = %s\n", name);
   mmu_del_vma(current_thread);
   double_linked_init(&current_thread->vma_list);
 
@@ -65,7 +71,7 @@ int exec(trapframe_t *tpf, const char *name, char *const argv[]) {
   char abs_path[MAX_PATH_NAME];
   strcpy(abs_path, name);
   path_to_absolute(abs_path, current_thread->cwd);
-  uart_sendline("exec: abs_path = %s\n", abs_path);
+  log_debug("exec: abs_path = %s\n", abs_path);
   vnode_t *target_file;
   vfs_lookup(abs_path, &target_file);
   current_thread->user_data_size = target_file->f_ops->getsize(target_file);
@@ -74,28 +80,21 @@ int exec(trapframe_t *tpf, const char *name, char *const argv[]) {
 
   asm("dsb ish\n"); // ensure write has completed
   mmu_free_page_tables(current_thread->context.pgd, 0);
-  simple_memset(PHYS_TO_VIRT((char *)(current_thread->context.pgd)), 0, 0x1000);
-  asm("tlbi vmalle1is\n" // invalidate all TLB entries
-      "dsb ish\n"        // ensure completion of TLB invalidatation
-      "isb\n");          // clear pipeline
-
-  file_t *f;
-  vfs_open(abs_path, 0, &f);
-  for (int i = 0; i <= current_thread->user_data_size / PAGE_SIZE; ++i) {
-    uint64_t new_page = buddy_system_allocator(PAGE_SIZE);
-    mmu_add_vma(current_thread, USER_SPACE + i * PAGE_SIZE, PAGE_SIZE,
-                VIRT_TO_PHYS(new_page), 0b111, 1);
-    // memcpy((char *)new_page, new_data + i * PAGE_SIZE, PAGE_SIZE);
-    vfs_read(f, (char *)new_page, PAGE_SIZE);
-    frame_array[VIRT_TO_PHYS(new_page) / PAGE_SIZE].ref++;
+  clear_page(PHYS_TO_VIRT((char *)(current_thread->context.pgd)));
+  tlb_flush_asid(current_thread->asid);
+
+  uint32_t text_pages = current_thread->user_data_size / PAGE_SIZE + 1;
+  if (mmu_map_file(current_thread, USER_SPACE, text_pages * PAGE_SIZE, 0b111,
+                   target_file, 0, 0)) {
+    tpf->x0 = -1;
+    return -1;
   }
-  vfs_close(f);
 
-  for (int i = 0; i < USTACK_SIZE / PAGE_SIZE; ++i) {
-    uint64_t new_page = buddy_system_allocator(PAGE_SIZE);
-    mmu_add_vma(current_thread, USER_STACK_BASE - USTACK_SIZE + i * PAGE_SIZE,
-                PAGE_SIZE, VIRT_TO_PHYS(new_page), 0b111, 1);
-    frame_array[VIRT_TO_PHYS(new_page) / PAGE_SIZE].ref++;
+  if (mmu_map_anon(current_thread, USER_STACK_BASE - USTACK_SIZE, USTACK_SIZE,
+                   0b111)) {
+    mmu_del_vma(current_thread);
+    tpf->x0 = -1;
+    return -1;
   }
   mmu_add_vma(current_thread, PERIPHERAL_START,
               PERIPHERAL_END - PERIPHERAL_START, PERIPHERAL_START, 0b011, 0);
@@ -115,6 +114,15 @@ int exec(trapframe_t *tpf, const char *name, char *const argv[]) {
 int fork(trapframe_t *tpf) {
   lock();
   thread_t *child_thread = thread_create(NULL, current_thread->user_data_size);
+  if (!child_thread) {
+    unlock();
+    tpf->x0 = -1;
+    return -1;
+  }
+  // Share every present entry write protected: one walk of the parent's
+  // tables per area, and one reference bump per physically contiguous run.
+  size_t *parent_pgd = (size_t *)PHYS_TO_VIRT(current_thread->context.pgd);
+  int failed = 0;
   double_linked_node_t *cur;
   vm_area_struct_t *vma;
   double_linked_for_each(cur, &current_thread->vma_list) {
@@ -123,23 +131,32 @@ int fork(trapframe_t *tpf) {
         vma->virt_addr == PERIPHERAL_START) {
       continue;
     }
-    mmu_add_vma(child_thread, vma->virt_addr, vma->area_size, vma->phys_addr,
-                vma->rwx, 1);
-    size_t flag = 0;
-    if (!(vma->rwx & (0b1 << 2)))
-      flag |= PD_UNX; // 4: executable
-    if (vma->rwx & (0b1 << 0))
-      flag |= PD_UK_ACCESS; // 1: readable / accessible
-    flag |= PD_RDONLY;
-    for (int i = 0; i < vma->area_size / PAGE_SIZE; ++i) {
-      frame_array[vma->phys_addr / PAGE_SIZE + i].ref++;
-      map_one_page((size_t *)PHYS_TO_VIRT(current_thread->context.pgd),
-                   vma->virt_addr + i * PAGE_SIZE,
-                   vma->phys_addr + i * PAGE_SIZE, flag);
-      map_one_page((size_t *)(child_thread->context.pgd),
-                   vma->virt_addr + i * PAGE_SIZE,
-                   vma->phys_addr + i * PAGE_SIZE, flag);
+    if (mmu_dup_vma(child_thread, vma)) {
+      failed = 1;
+      break;
+    }
+    // shared file pages stay writable: there is nothing to copy
+    size_t wrprotect =
+        (vma->rwx & 0b10) && !vma->map_shared ? PD_RDONLY : 0;
+    if (mmu_fork_range(parent_pgd, (size_t *)child_thread->context.pgd,
+                       vma->virt_addr, vma->area_size, wrprotect)) {
+      failed = 1;
+    }
+    // the parent's writable entries just became read-only
+    if (wrprotect) {
+      tlb_flush_range(current_thread->asid, vma->virt_addr, vma->area_size);
     }
+    if (failed) {
+      break;
+    }
+  }
+  if (failed) {
+    // let kill_zombies reclaim the half-built child
+    child_thread->context.pgd = VIRT_TO_PHYS(child_thread->context.pgd);
+    child_thread->state = THREAD_ZOMBIE;
+    unlock();
+    tpf->x0 = -1;
+    return -1;
   }
   mmu_add_vma(child_thread, PERIPHERAL_START, PERIPHERAL_END - PERIPHERAL_START,
               PERIPHERAL_START, 0b011, 0);
@@ -152,7 +169,7 @@ int fork(trapframe_t *tpf) {
   // copy file handle
   for (int i = 0; i <= MAX_FD; ++i) {
     if (current_thread->fdt[i]) {
-      child_thread->fdt[i] = memory_pool_allocator(sizeof(file_t), 0);
+      child_thread->fdt[i] = kmem_cache_alloc(file_cache);
       *child_thread->fdt[i] = *current_thread->fdt[i];
     }
   }
@@ -163,10 +180,12 @@ int fork(trapframe_t *tpf) {
     //               current_thread->signal_handler[i]);
     child_thread->signal_handler[i] = current_thread->signal_handler[i];
   }
-  // copy kernel stack into new process
-  for (uint32_t i = 0; i < KSTACK_SIZE; ++i) {
-    child_thread->kernel_stack[i] = current_thread->kernel_stack[i];
-  }
+  // Copy the live part of the kernel stack: the child resumes in this frame,
+  // and nothing below it is ever read again.
+  uint64_t sp;
+  asm volatile("mov %0, sp" : "=r"(sp));
+  uint64_t live = (uint64_t)current_thread->kernel_stack + KSTACK_SIZE - sp;
+  memcpy((char *)sp + kernel_stack_offset, (char *)sp, live);
 
   store_context(get_current());
   if (parent_pid != current_thread->pid) {
@@ -193,7 +212,7 @@ child:
 
 int syscall_mbox_call(trapframe_t *tpf, uint8_t ch, uint32_t *mbox_user) {
   lock();
-  uart_sendline("mbox_user: 0x%p\n", mbox_user);
+  log_debug("mbox_user: 0x%p\n", mbox_user);
   uint32_t size_of_mbox = mbox_user[0];
   memcpy((char *)mbox, mbox_user, size_of_mbox);
   mbox_call(MBOX_CH_PROP);
@@ -239,55 +258,111 @@ void signal_return(trapframe_t *tpf) {
   load_context(&current_thread->signal_context);
 }
 
-// only need to implement the anonymous page mapping in this Lab.
+// Anonymous memory, or with MAP_SHARED / MAP_PRIVATE and an open fd, the
+// file from file_offset (page-aligned) on. Either way pages are demand
+// faulted.
 void *mmap(trapframe_t *tpf, void *addr, size_t len, int prot, int flags,
            int fd, int file_offset) {
-  uart_sendline("mmap: addr = 0x%p, len = %l, prot = %d, flags = %d, fd = %d, "
-                "file_offset = %d\n",
-                addr, len, prot, flags, fd, file_offset);
-  // Ignore flags as we have demand pages
+  log_debug("mmap: addr = 0x%p, len = %l, prot = %d, flags = %d, fd = %d, "
+            "file_offset = %d\n",
+            addr, len, prot, flags, fd, file_offset);
+  vnode_t *vnode = NULL;
+  if (!(flags & MAP_ANONYMOUS) && (flags & (MAP_SHARED | MAP_PRIVATE))) {
+    if (fd < 0 || fd > MAX_FD || !current_thread->fdt[fd] ||
+        file_offset < 0 || file_offset % PAGE_SIZE ||
+        current_thread->fdt[fd]->vnode->f_ops->getsize(
+            current_thread->fdt[fd]->vnode) < 0) {
+      tpf->x0 = 0;
+      return NULL;
+    }
+    vnode = current_thread->fdt[fd]->vnode;
+    // A filesystem that maps its pages in place (the initramfs image) has
+    // no other copy of the file to write back to, and cannot be written.
+    if ((flags & MAP_SHARED) && (prot & 0b10) && vnode->f_ops->map_page) {
+      tpf->x0 = 0;
+      return NULL;
+    }
+  }
 
   // Req #3 Page size round up
   len = len % 0x1000 ? len + (0x1000 - len % 0x1000) : len;
   addr = (uint64_t)addr % 0x1000 ? addr + (0x1000 - (uint64_t)addr % 0x1000)
                                  : addr;
-  // Req #2 check if overlap
-  double_linked_node_t *cur;
-  vm_area_struct_t *the_area_ptr = NULL;
-  double_linked_for_each(cur, &current_thread->vma_list) {
-    vm_area_struct_t *vma = (vm_area_struct_t *)cur;
-    // Detect existing vma overlapped
-    if (!((uint64_t)(addr + len) <= vma->virt_addr ||
-          (uint64_t)addr >= vma->virt_addr + vma->area_size)) {
-      the_area_ptr = vma;
-      break;
-    }
-  }
-  // take as a hint to decide new region's start address
-  if (the_area_ptr) {
-    tpf->x0 = (uint64_t)mmap(
-        tpf, (void *)(the_area_ptr->virt_addr + the_area_ptr->area_size), len,
-        prot, flags, fd, file_offset);
-    return (void *)tpf->x0;
+  // Req #2 the address is only a hint: take the first free range at or
+  // after it. Big regions start on a 2MB boundary so they can be backed by
+  // huge pages.
+  uint64_t align = len >= HUGE_PAGE_SIZE && !vnode ? HUGE_PAGE_SIZE : PAGE_SIZE;
+  // the range must still be free when the area goes in
+  lock();
+  uint64_t start = vma_tree_find_gap(current_thread->vma_root, (uint64_t)addr,
+                                     len, align, USER_SPACE_END);
+  if (start == VMA_NO_GAP) {
+    unlock();
+    tpf->x0 = 0;
+    return NULL;
   }
+  addr = (void *)start;
   // create new valid region, map and set the page attributes (prot)
-  uint64_t new_page = buddy_system_allocator(len);
-  mmu_add_vma(current_thread, (uint64_t)addr, len, VIRT_TO_PHYS(new_page), prot,
-              1);
-  for (int i = 0; i < len / PAGE_SIZE; ++i) {
-    frame_array[VIRT_TO_PHYS(new_page) / PAGE_SIZE].ref++;
+  int failed =
+      vnode ? mmu_map_file(current_thread, (uint64_t)addr, len, prot, vnode,
+                           file_offset, flags & MAP_SHARED)
+            : mmu_map_anon(current_thread, (uint64_t)addr, len, prot);
+  unlock();
+  if (failed) {
+    tpf->x0 = 0;
+    return NULL;
   }
-  uart_sendline("mmap: return addr = 0x%p\n", addr);
+  log_debug("mmap: return addr = 0x%p\n", addr);
   tpf->x0 = (uint64_t)addr;
   return (void *)tpf->x0;
 }
 
+int sys_munmap(trapframe_t *tpf, void *addr, size_t len) {
+  log_debug("munmap: addr = 0x%p, len = %l\n", addr, len);
+  if ((uint64_t)addr % PAGE_SIZE || !len) {
+    tpf->x0 = -1;
+    return -1;
+  }
+  len = len % PAGE_SIZE ? len + (PAGE_SIZE - len % PAGE_SIZE) : len;
+  lock();
+  tpf->x0 = mmu_unmap(current_thread, (uint64_t)addr, len);
+  unlock();
+  return tpf->x0;
+}
+
+// Write back the dirty pages of every shared file mapping in the range.
+int sys_msync(trapframe_t *tpf, void *addr, size_t len, int flags) {
+  log_debug("msync: addr = 0x%p, len = %l, flags = %d\n", addr, len, flags);
+  uint64_t start = (uint64_t)addr & ~(PAGE_SIZE - 1);
+  uint64_t end = (uint64_t)addr + len;
+  int ret = 0;
+  lock();
+  double_linked_node_t *cur;
+  double_linked_for_each(cur, &current_thread->vma_list) {
+    vm_area_struct_t *vma = (vm_area_struct_t *)cur;
+    uint64_t lo = vma->virt_addr > start ? vma->virt_addr : start;
+    uint64_t hi = vma->virt_addr + vma->area_size;
+    hi = hi < end ? hi : end;
+    if (!vma->map_shared || lo >= hi) {
+      continue;
+    }
+    if (page_cache_writeback(vma->vnode,
+                             vma->file_offset + (lo - vma->virt_addr),
+                             hi - lo)) {
+      ret = -1;
+    }
+  }
+  unlock();
+  tpf->x0 = ret;
+  return ret;
+}
+
 int sys_open(trapframe_t *tpf, const char *pathname, int flags) {
-  uart_sendline("sys_open: pathname = %s, flags = %d\n", pathname, flags);
+  log_debug("sys_open: pathname = %s, flags = %d\n", pathname, flags);
   char abs_path[MAX_PATH_NAME + 1];
   strcpy(abs_path, pathname);
   path_to_absolute(abs_path, current_thread->cwd);
-  uart_sendline("sys_open: abs_path = %s\n", abs_path);
+  log_debug("sys_open: abs_path = %s\n", abs_path);
   for (int i = 0; i <= MAX_FD; ++i) {
     if (!current_thread->fdt[i]) {
       if (vfs_open(abs_path, flags, &current_thread->fdt[i]) != 0) {
@@ -302,7 +377,7 @@ int sys_open(trapframe_t *tpf, const char *pathname, int flags) {
 }
 
 int sys_close(trapframe_t *tpf, int fd) {
-  uart_sendline("sys_close: fd = %d\n", fd);
+  log_debug("sys_close: fd = %d\n", fd);
   if (current_thread->fdt[fd]) {
     vfs_close(current_thread->fdt[fd]);
     current_thread->fdt[fd] = NULL;
@@ -315,7 +390,7 @@ int sys_close(trapframe_t *tpf, int fd) {
 
 long sys_write(trapframe_t *tpf, int fd, const void *buf, size_t count) {
   if (thread_count <= 2) {
-    uart_sendline("sys_write: fd = %d, buf = %s, count = %d\n", fd, buf, count);
+    log_debug("sys_write: fd = %d, buf = %s, count = %d\n", fd, buf, count);
   }
   if (current_thread->fdt[fd]) {
     tpf->x0 = vfs_write(current_thread->fdt[fd], buf, count);
@@ -328,7 +403,7 @@ long sys_write(trapframe_t *tpf, int fd, const void *buf, size_t count) {
 long sys_read(trapframe_t *tpf, int fd, void *buf, size_t count) {
   if (current_thread->fdt[fd]) {
     tpf->x0 = vfs_read(current_thread->fdt[fd], buf, count);
-    uart_sendline("sys_read: fd = %d, buf = %s, count = %d\n", fd, buf, count);
+    log_debug("sys_read: fd = %d, buf = %s, count = %d\n", fd, buf, count);
     return tpf->x0;
   }
   tpf->x0 = -1;
@@ -336,41 +411,41 @@ long sys_read(trapframe_t *tpf, int fd, void *buf, size_t count) {
 }
 
 int sys_mkdir(trapframe_t *tpf, const char *pathname, uint32_t mode) {
-  uart_sendline("sys_mkdir: pathname = %s, mode = %d\n", pathname, mode);
+  log_debug("sys_mkdir: pathname = %s, mode = %d\n", pathname, mode);
   char abs_path[MAX_PATH_NAME + 1];
   strcpy(abs_path, pathname);
   path_to_absolute(abs_path, current_thread->cwd);
-  uart_sendline("sys_mkdir: abs_path = %s\n", abs_path);
+  log_debug("sys_mkdir: abs_path = %s\n", abs_path);
   tpf->x0 = vfs_mkdir(abs_path);
   return tpf->x0;
 }
 
 int sys_mount(trapframe_t *tpf, const char *src, const char *target,
               const char *filesystem, size_t flags, const void *data) {
-  uart_sendline("sys_mount: src = %s, target = %s, filesystem = %s, \n", src,
-                target, filesystem);
+  log_debug("sys_mount: src = %s, target = %s, filesystem = %s, \n", src,
+            target, filesystem);
   char abs_path[MAX_PATH_NAME + 1];
   strcpy(abs_path, target);
   path_to_absolute(abs_path, current_thread->cwd);
-  uart_sendline("sys_mount: abs_path = %s\n", abs_path);
+  log_debug("sys_mount: abs_path = %s\n", abs_path);
   tpf->x0 = vfs_mount(abs_path, filesystem);
   return tpf->x0;
 }
 
 int sys_chdir(trapframe_t *tpf, const char *path) {
-  uart_sendline("sys_chdir: path = %s\n", path);
+  log_debug("sys_chdir: path = %s\n", path);
   char abs_path[MAX_PATH_NAME + 1];
   strcpy(abs_path, path);
   path_to_absolute(abs_path, current_thread->cwd);
-  uart_sendline("sys_chdir: abs_path = %s\n", abs_path);
+  log_debug("sys_chdir: abs_path = %s\n", abs_path);
   strcpy(current_thread->cwd, abs_path);
   return 0;
 }
 
 long sys_lseek64(trapframe_t *tpf, int fd, long offset, int whence) {
   if (thread_count <= 2) {
-    uart_sendline("sys_lseek64: fd = %d, offset = %l, whence = %d\n", fd,
-                  offset, whence);
+    log_debug("sys_lseek64: fd = %d, offset = %l, whence = %d\n", fd, offset,
+              whence);
   }
   tpf->x0 = vfs_lseek64(current_thread->fdt[fd], offset, whence);
   return tpf->x0;
@@ -1,25 +1,36 @@
 #include "include/thread.h"
 #include "include/allocator.h"
 #include "include/buddy_system.h"
+#include "include/cache.h"
 #include "include/dlist.h"
 #include "include/exception.h"
 #include "include/heap.h"
 #include "include/mmu.h"
+#include "include/shrinker.h"
 #include "include/signal.h"
+#include "include/slab.h"
 #include "include/timer.h"
 #include "include/types.h"
 #include "include/uart.h"
 #include "include/utils.h"
+#include "include/vmalloc.h"
 
 extern thread_t *current_thread;
 extern double_linked_node_t *run_queue;
 extern thread_t thread_table[];
 extern frame_array_node_t frame_array[];
 extern uint32_t thread_count;
+extern kmem_cache_t *vma_cache;
+extern char *thread_stack_cache[];
+extern uint32_t thread_stack_cache_count;
 
 void thread_init() {
   run_queue = simple_malloc(sizeof(double_linked_node_t), 0);
   double_linked_init(run_queue);
+  vma_cache = kmem_cache_create("vm_area_struct", sizeof(vm_area_struct_t));
+  buddy_system_register_migrate(mmu_migrate_page);
+  register_shrinker("thread stacks", thread_stack_shrink_count,
+                    thread_stack_shrink_scan);
 
   for (int i = 0; i <= PID_MAX; ++i) {
     thread_table[i].state = THREAD_IDLE;
@@ -29,30 +40,45 @@ void thread_init() {
   asm volatile(
       "msr tpidr_el1, %0" ::"r"(simple_malloc(sizeof(thread_context_t), 0)));
   current_thread = thread_create(idle, 0x1000);
-  current_thread->context.pgd = (char *)MMU_PGD_BASE;
+  mmu_asid_init(current_thread->context.pgd);
 }
 
 thread_t *thread_create(void *entry_point, uint32_t size) {
   lock();
   // find idle thread
-  thread_t *new_thread;
+  thread_t *new_thread = NULL;
   for (int i = 0; i <= PID_MAX; ++i) {
     if (thread_table[i].state == THREAD_IDLE) {
       new_thread = &thread_table[i];
       break;
     }
   }
+  char *kernel_stack = new_thread ? thread_stack_alloc() : NULL;
+  uint64_t pgd = 0;
+  if (kernel_stack) {
+    alloc_pages_bulk(1, &pgd, GFP_KERNEL | __GFP_ZERO);
+  }
+  if (!pgd) {
+    if (kernel_stack) {
+      thread_stack_free(kernel_stack);
+    }
+    uart_sendline("[Thread Error] Cannot create thread.\n");
+    unlock();
+    return NULL;
+  }
 
   // thread setup
   new_thread->context.lr = (uint64_t)entry_point;
   new_thread->state = THREAD_READY;
   new_thread->user_data_size = size;
-  new_thread->kernel_stack = (char *)buddy_system_allocator(KSTACK_SIZE);
-  new_thread->context.pgd = (void *)buddy_system_allocator(0x1000);
-  simple_memset(new_thread->context.pgd, 0, 0x1000);
+  new_thread->kernel_stack = kernel_stack;
+  new_thread->context.pgd = (void *)pgd;
+  new_thread->asid = 0;
   new_thread->context.sp = (uint64_t)new_thread->kernel_stack + KSTACK_SIZE;
   new_thread->context.fp = new_thread->context.sp;
   double_linked_init(&new_thread->vma_list);
+  new_thread->vma_root = NULL;
+  new_thread->vma_last = NULL;
 
   // file descriptor setup
   strcpy(new_thread->cwd, "/");
@@ -73,20 +99,21 @@ thread_t *thread_create(void *entry_point, uint32_t size) {
   return new_thread;
 }
 
-int exec_thread(char *data, uint32_t size) {
-  thread_t *new_thread = thread_create(data, size);
-  for (int i = 0; i <= size / PAGE_SIZE; ++i) {
-    uint64_t new_page = buddy_system_allocator(PAGE_SIZE);
-    mmu_add_vma(new_thread, USER_SPACE + i * PAGE_SIZE, PAGE_SIZE,
-                VIRT_TO_PHYS(new_page), 0b111, 1);
-    memcpy((char *)new_page, data + i * PAGE_SIZE, PAGE_SIZE);
-    frame_array[VIRT_TO_PHYS(new_page) / PAGE_SIZE].ref++;
-  }
-  for (int i = 0; i < USTACK_SIZE / PAGE_SIZE; ++i) {
-    uint64_t new_page = buddy_system_allocator(PAGE_SIZE);
-    mmu_add_vma(new_thread, USER_STACK_BASE - USTACK_SIZE + i * PAGE_SIZE,
-                PAGE_SIZE, VIRT_TO_PHYS(new_page), 0b111, 1);
-    frame_array[VIRT_TO_PHYS(new_page) / PAGE_SIZE].ref++;
+int exec_thread(vnode_t *file) {
+  uint32_t size = file->f_ops->getsize(file);
+  thread_t *new_thread = thread_create(NULL, size);
+  if (!new_thread) {
+    return -1;
+  }
+  uint32_t text_pages = size / PAGE_SIZE + 1;
+  if (mmu_map_file(new_thread, USER_SPACE, text_pages * PAGE_SIZE, 0b111,
+                   file, 0, 0)) {
+    goto fail;
+  }
+  if (mmu_map_anon(new_thread, USER_STACK_BASE - USTACK_SIZE, USTACK_SIZE,
+                   0b111)) {
+    mmu_del_vma(new_thread);
+    goto fail;
   }
   mmu_add_vma(new_thread, PERIPHERAL_START, PERIPHERAL_END - PERIPHERAL_START,
               PERIPHERAL_START, 0b011, 0);
@@ -112,16 +139,53 @@ int exec_thread(char *data, uint32_t size) {
       "msr sp_el0, %2\n"
       "mov sp, %3\n"
       "dsb ish\n" // ensure write has completed
-      "msr ttbr0_el1, %4\n"
-      "tlbi vmalle1is\n" // invalidate all TLB entries
-      "dsb ish\n"        // ensure completion of TLB invalidatation
-      "isb\n"            // clear pipeline"
+      "msr ttbr0_el1, %4\n" // a fresh ASID, nothing to invalidate
+      "isb\n"               // clear pipeline"
       "eret\n" ::"r"(&new_thread->context),
       "r"(new_thread->context.lr), "r"(new_thread->context.sp),
       "r"(new_thread->kernel_stack + KSTACK_SIZE),
-      "r"(new_thread->context.pgd));
+      "r"(mmu_ttbr0(new_thread)));
 
   return 0;
+
+fail:
+  // let kill_zombies reclaim the half-built thread
+  new_thread->context.pgd = VIRT_TO_PHYS(new_thread->context.pgd);
+  new_thread->state = THREAD_ZOMBIE;
+  return -1;
+}
+
+// Kernel stacks of reaped threads are kept for the next thread_create, since
+// they are the largest per-thread allocation; the shrinker hands them back.
+// They are vmalloc'ed, so a thread never needs an order-4 buddy block.
+char *thread_stack_alloc() {
+  if (thread_stack_cache_count > 0) {
+    return thread_stack_cache[--thread_stack_cache_count];
+  }
+  return (char *)vmalloc(KSTACK_SIZE);
+}
+
+void thread_stack_free(char *stack) {
+  if (thread_stack_cache_count < THREAD_STACK_CACHE_MAX) {
+    thread_stack_cache[thread_stack_cache_count++] = stack;
+  } else {
+    vfree(stack);
+  }
+}
+
+// Only cached stacks are handed back: reaping zombies is left to idle, as
+// a shrinker may run in the middle of any allocation.
+uint32_t thread_stack_shrink_count() {
+  return thread_stack_cache_count * (KSTACK_SIZE / PAGE_SIZE);
+}
+
+uint32_t thread_stack_shrink_scan(uint32_t nr_pages) {
+  uint32_t freed = 0;
+  while (thread_stack_cache_count > 0 && freed < nr_pages) {
+    vfree(thread_stack_cache[--thread_stack_cache_count]);
+    freed += KSTACK_SIZE / PAGE_SIZE;
+  }
+  return freed;
 }
 
 void schedule() {
@@ -134,7 +198,8 @@ void schedule() {
   } while ((double_linked_node_t *)current_thread == run_queue ||
            current_thread->state != THREAD_READY);
   current_thread->state = THREAD_RUNNING;
-  switch_to(get_current(), &current_thread->context);
+  switch_to(get_current(), &current_thread->context,
+            mmu_ttbr0(current_thread));
   unlock();
 }
 
@@ -142,19 +207,21 @@ void kill_zombies() {
   lock();
   double_linked_node_t *cur;
   double_linked_for_each(cur, run_queue) {
-    if (((thread_t *)cur)->state == THREAD_ZOMBIE) {
+    // the running thread may still be standing on its kernel stack
+    if (((thread_t *)cur)->state == THREAD_ZOMBIE &&
+        (thread_t *)cur != current_thread) {
       double_linked_remove(cur);
       thread_t *thread = (thread_t *)cur;
       thread->state = THREAD_IDLE;
       mmu_del_vma(thread);
       mmu_free_page_tables(thread->context.pgd, 0);
       buddy_system_free((uint64_t)PHYS_TO_VIRT(thread->context.pgd));
-      buddy_system_free((uint64_t)thread->kernel_stack);
+      thread_stack_free(thread->kernel_stack);
       // close file descriptor
       for (int i = 0; i <= MAX_FD; ++i) {
-        if (current_thread->fdt[i]) {
-          vfs_close(current_thread->fdt[i]);
-          current_thread->fdt[i] = NULL;
+        if (thread->fdt[i]) {
+          vfs_close(thread->fdt[i]);
+          thread->fdt[i] = NULL;
         }
       }
       thread_count--;
@@ -182,6 +249,7 @@ void thread_test() {
 void idle() {
   while (1) {
     kill_zombies();
+    buddy_system_zero_pool_fill(ZERO_POOL_FILL_BATCH);
     schedule();
   }
 }
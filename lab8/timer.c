@@ -3,11 +3,13 @@
 #include "include/dlist.h"
 #include "include/exception.h"
 #include "include/heap.h"
+#include "include/slab.h"
 #include "include/types.h"
 #include "include/uart.h"
 #include "include/utils.h"
 
 extern double_linked_node_t *timer_list_head;
+extern kmem_cache_t *timer_task_cache;
 
 void timer_init() {
   uint64_t tmp;
@@ -17,6 +19,7 @@ void timer_init() {
 
   timer_list_head = simple_malloc(sizeof(double_linked_node_t), 0);
   double_linked_init(timer_list_head);
+  timer_task_cache = kmem_cache_create("timer_task", sizeof(timer_task_t));
 }
 
 void core_timer_enable() {
@@ -28,7 +31,7 @@ void core_timer_disable() { *CORE0_TIMER_IRQCNTL = 0x0; };
 
 timer_task_t *create_timer_task(int time, void *callback, const char *arg,
                                 int priority) {
-  timer_task_t *task = memory_pool_allocator(sizeof(timer_task_t), 0);
+  timer_task_t *task = kmem_cache_alloc(timer_task_cache);
   unsigned long cntpct_el0 = 0;
   unsigned long cntfrq_el0 = 0;
   __asm__ __volatile__("mrs %0, cntpct_el0" : "=r"(cntpct_el0));
@@ -46,7 +49,7 @@ timer_task_t *create_timer_task(int time, void *callback, const char *arg,
   } else {
     total_length = strlen(prefix) + strlen(arg) + 1;
   }
-  char *buf = memory_pool_allocator(total_length, 0);
+  char *buf = kmalloc(total_length, GFP_KERNEL);
   strcpy(buf, prefix);
   if (arg != NULL) {
     strcat(buf, arg);
@@ -93,7 +96,7 @@ void add_timer_task_to_irq() {
   // core_timer_enable();
   irq_task_list_insert(
       create_irq_task(task->callback, task->callback_arg, task->priority));
-  memory_pool_free(task, 0);
+  kmem_cache_free(timer_task_cache, task);
 }
 
 void core_timer_update() {
@@ -0,0 +1,43 @@
+#include "include/tlb.h"
+#include "include/buddy_system.h"
+#include "include/mmu.h"
+#include "include/types.h"
+
+// tlbi operand: ASID[63:48], VA[55:12] in bits [43:0].
+static inline uint64_t tlb_operand(uint64_t asid, size_t va) {
+  return ((asid & ASID_MASK) << TTBR_ASID_SHIFT) |
+         ((va >> PAGE_SHIFT) & 0xfffffffffffUL);
+}
+
+// Drop the translation of the page at va in one address space, e.g. after
+// a copy on write. Walk cache entries for va go as well, so this also
+// covers a table entry replaced by a block.
+void tlb_flush_page(uint64_t asid, size_t va) {
+  asm volatile("dsb ishst\n"
+               "tlbi vae1is, %0\n"
+               "dsb ish\n"
+               "isb\n" ::"r"(tlb_operand(asid, va)));
+}
+
+void tlb_flush_range(uint64_t asid, size_t va, size_t size) {
+  size_t end = va + size;
+  va &= ~(PAGE_SIZE - 1);
+  if ((end - va) / PAGE_SIZE > TLB_FLUSH_RANGE_MAX_PAGES) {
+    tlb_flush_asid(asid);
+    return;
+  }
+  asm volatile("dsb ishst");
+  for (; va < end; va += PAGE_SIZE) {
+    asm volatile("tlbi vae1is, %0" ::"r"(tlb_operand(asid, va)));
+  }
+  asm volatile("dsb ish\n"
+               "isb\n");
+}
+
+// Drop the TLB entries of one address space; the other ASIDs keep theirs.
+void tlb_flush_asid(uint64_t asid) {
+  asm volatile("dsb ishst\n"
+               "tlbi aside1is, %0\n"
+               "dsb ish\n"
+               "isb\n" ::"r"(tlb_operand(asid, 0)));
+}
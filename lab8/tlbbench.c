@@ -0,0 +1,111 @@
+#include "include/tlbbench.h"
+#include "include/allocator.h"
+#include "include/buddy_system.h"
+#include "include/exception.h"
+#include "include/mmu.h"
+#include "include/pmu.h"
+#include "include/thread.h"
+#include "include/tlb.h"
+#include "include/types.h"
+#include "include/uart.h"
+
+extern thread_t *current_thread;
+
+typedef struct {
+  uint64_t pgd; // kernel virtual
+  uint64_t pages[TLBBENCH_PAGES];
+  uint64_t asid;
+} tlbbench_space_t;
+
+static void tlbbench_space_free(tlbbench_space_t *space) {
+  if (space->pgd) {
+    mmu_free_page_tables((size_t *)VIRT_TO_PHYS(space->pgd), 0);
+    buddy_system_free(space->pgd);
+  }
+  for (int i = 0; i < TLBBENCH_PAGES; ++i) {
+    if (space->pages[i]) {
+      buddy_system_free(space->pages[i]);
+    }
+  }
+}
+
+// An address space of TLBBENCH_PAGES pages at TLBBENCH_VA, standing in for
+// a process. Returns -1 when out of memory.
+static int tlbbench_space_init(tlbbench_space_t *space) {
+  *space = (tlbbench_space_t){0};
+  if (!alloc_pages_bulk(1, &space->pgd, GFP_KERNEL | __GFP_ZERO)) {
+    space->pgd = 0;
+    return -1;
+  }
+  if (!alloc_pages_bulk(TLBBENCH_PAGES, space->pages, GFP_KERNEL)) {
+    *space = (tlbbench_space_t){.pgd = space->pgd};
+    return -1;
+  }
+  for (int i = 0; i < TLBBENCH_PAGES; ++i) {
+    if (map_one_page((size_t *)space->pgd, TLBBENCH_VA + i * PAGE_SIZE,
+                     VIRT_TO_PHYS(space->pages[i]), PD_UNX)) {
+      return -1;
+    }
+  }
+  mmu_asid(&space->asid);
+  return 0;
+}
+
+// Switch to space the way the scheduler does, with or without the full
+// flush it used to issue, then touch every page.
+static void tlbbench_switch(tlbbench_space_t *space, int flush) {
+  uint64_t ttbr0 = VIRT_TO_PHYS(space->pgd) |
+                   (space->asid & ASID_MASK) << TTBR_ASID_SHIFT;
+  asm volatile("dsb ish\n"
+               "msr ttbr0_el1, %0\n"
+               "isb\n" ::"r"(ttbr0));
+  if (flush) {
+    asm volatile("tlbi vmalle1is\n"
+                 "dsb ish\n"
+                 "isb\n");
+  }
+  for (int i = 0; i < TLBBENCH_PAGES; ++i) {
+    (void)*(volatile uint64_t *)(TLBBENCH_VA + i * PAGE_SIZE);
+  }
+}
+
+static void tlbbench_measure(const char *name, tlbbench_space_t *a,
+                             tlbbench_space_t *b, int flush) {
+  uint64_t cycles = pmu_cycles();
+  uint64_t refills = pmu_events();
+  for (int i = 0; i < TLBBENCH_ROUNDS; ++i) {
+    tlbbench_switch(a, flush);
+    tlbbench_switch(b, flush);
+  }
+  cycles = pmu_cycles() - cycles;
+  refills = pmu_events() - refills;
+  uart_sendline("%s\t%l\t\t%l\n", name, cycles / (2 * TLBBENCH_ROUNDS),
+                refills / (2 * TLBBENCH_ROUNDS));
+}
+
+// Cost of a context switch plus touching TLBBENCH_PAGES pages afterwards,
+// ping-ponging between two address spaces: once flushing the whole TLB on
+// every switch, once relying on the ASID tags. Interrupts stay off so the
+// timer does not switch in between.
+void tlbbench_run() {
+  tlbbench_space_t a, b = {0};
+  if (tlbbench_space_init(&a) || tlbbench_space_init(&b)) {
+    uart_sendline("[tlbbench Error] Out of memory.\n");
+    tlbbench_space_free(&a);
+    tlbbench_space_free(&b);
+    return;
+  }
+  lock();
+  pmu_enable(PMU_L1D_TLB_REFILL);
+  uart_sendline("per switch   cycles  L1D TLB refills\n");
+  tlbbench_measure("full flush", &a, &b, 1);
+  tlbbench_measure("ASID", &a, &b, 0);
+  asm volatile("dsb ish\n"
+               "msr ttbr0_el1, %0\n"
+               "isb\n" ::"r"(mmu_ttbr0(current_thread)));
+  tlb_flush_asid(a.asid);
+  tlb_flush_asid(b.asid);
+  unlock();
+  tlbbench_space_free(&a);
+  tlbbench_space_free(&b);
+}
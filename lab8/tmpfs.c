@@ -2,11 +2,16 @@
 #include "include/allocator.h"
 #include "include/buddy_system.h"
 #include "include/heap.h"
+#include "include/slab.h"
 #include "include/types.h"
 #include "include/uart.h"
 #include "include/utils.h"
 #include "include/vfs.h"
 
+extern kmem_cache_t *vnode_cache;
+extern kmem_cache_t *file_cache;
+extern kmem_cache_t *tmpfs_inode_cache;
+
 file_operations_t tmpfs_file_operations = {tmpfs_write, tmpfs_read,
                                            tmpfs_open,  tmpfs_close,
                                            vfs_lseek64, tmpfs_getsize};
@@ -18,6 +23,10 @@ int register_tmpfs() {
   fs.name = "tmpfs";
   fs.setup_mount = tmpfs_setup_mount;
   fs.syncfs = tmpfs_sync;
+  if (!tmpfs_inode_cache) {
+    tmpfs_inode_cache =
+        kmem_cache_create("tmpfs_inode", sizeof(tmpfs_inode_t));
+  }
   return register_filesystem(&fs);
 }
 
@@ -30,23 +39,29 @@ int tmpfs_setup_mount(filesystem_t *fs, mount_t *_mount) {
 int tmpfs_sync() { return 0; }
 
 vnode_t *tmpfs_create_vnode(mount_t *_mount, node_type_t type) {
-  vnode_t *v = memory_pool_allocator(sizeof(vnode_t), 0);
+  vnode_t *v = kmem_cache_alloc(vnode_cache);
   v->mount = _mount;
   v->v_ops = &tmpfs_vnode_operations;
   v->f_ops = &tmpfs_file_operations;
   v->type = TMP;
-  tmpfs_inode_t *inode = memory_pool_allocator(sizeof(tmpfs_inode_t), 0);
+  tmpfs_inode_t *inode = kmem_cache_alloc(tmpfs_inode_cache);
   simple_memset(inode, 0, sizeof(tmpfs_inode_t));
   inode->type = type;
-  inode->data = (char *)buddy_system_allocator(0x1000);
-  simple_memset(inode->data, 0, 0x1000);
+  inode->data = NULL; // allocated on first write
   inode->datasize = 0;
   v->internal = inode;
+  v->page_cache = NULL;
   return v;
 }
 
 int tmpfs_write(file_t *file, const void *buf, size_t len) {
   tmpfs_inode_t *inode = file->vnode->internal;
+  if (!inode->data) {
+    inode->data = kmalloc(MAX_FILE_SIZE, GFP_KERNEL | __GFP_ZERO);
+    if (!inode->data) {
+      return -1;
+    }
+  }
   memcpy(inode->data + file->f_pos, buf, len);
   file->f_pos += len;
   if (file->f_pos > inode->datasize) {
@@ -78,7 +93,7 @@ int tmpfs_open(vnode_t *file_node, file_t **target) {
 }
 
 int tmpfs_close(file_t *file) {
-  memory_pool_free(file, 0);
+  kmem_cache_free(file_cache, file);
   return 0;
 }
 
@@ -178,4 +193,4 @@ int tmpfs_mkdir(vnode_t *dir_node, vnode_t **target,
   strcpy(newinode->name, component_name);
   *target = _vnode;
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,400 @@
+// Benchmark and trace-replay driver for the kernel allocators on the host.
+//
+//   allocbench [-n ops] [-s seed] [-v] forkexec | churn | mixed
+//   allocbench [-v] replay <uart log>
+//
+// Each allocator call is timed on its own; the report gives throughput,
+// latency percentiles and the worst fragmentation index seen per order.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+void allocbench_init(unsigned long base, int verbose);
+unsigned long allocbench_page_alloc(unsigned int size);
+void allocbench_page_free(unsigned long address);
+void *allocbench_pool_alloc(unsigned int size);
+void allocbench_pool_free(void *address);
+void *allocbench_cache_alloc(const char *name, unsigned int size);
+void allocbench_cache_free(void *object);
+unsigned long allocbench_free_pages();
+unsigned int allocbench_max_order();
+unsigned int allocbench_fragmentation(unsigned int order);
+unsigned long allocbench_total_memory();
+void allocbench_report();
+
+#define PAGE_SIZE 4096
+#define FRAG_SAMPLE_INTERVAL 64
+#define MAX_ORDER 32
+
+static uint64_t *latencies;
+static size_t latency_count, latency_capacity;
+static unsigned int peak_frag[MAX_ORDER];
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t rng() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static void record(uint64_t start) {
+  uint64_t ns = now_ns() - start;
+  if (latency_count == latency_capacity) {
+    latency_capacity = latency_capacity ? latency_capacity * 2 : 1 << 16;
+    latencies = realloc(latencies, latency_capacity * sizeof(*latencies));
+  }
+  latencies[latency_count++] = ns;
+  if (latency_count % FRAG_SAMPLE_INTERVAL == 0) {
+    for (unsigned int i = 0; i <= allocbench_max_order(); ++i) {
+      unsigned int frag = allocbench_fragmentation(i);
+      if (frag > peak_frag[i]) {
+        peak_frag[i] = frag;
+      }
+    }
+  }
+}
+
+static unsigned long page_alloc(unsigned int size) {
+  uint64_t start = now_ns();
+  unsigned long address = allocbench_page_alloc(size);
+  record(start);
+  return address;
+}
+
+static void page_free(unsigned long address) {
+  uint64_t start = now_ns();
+  allocbench_page_free(address);
+  record(start);
+}
+
+static void *pool_alloc(unsigned int size) {
+  uint64_t start = now_ns();
+  void *object = allocbench_pool_alloc(size);
+  record(start);
+  return object;
+}
+
+static void pool_free(void *object) {
+  uint64_t start = now_ns();
+  allocbench_pool_free(object);
+  record(start);
+}
+
+// ---------------------------------------------------------------------------
+// Synthetic workloads
+
+#define PROC_MAX 64
+#define PROC_PAGES_MAX 128
+
+// What exec_thread and fork allocate for one process: a PGD, a kernel
+// stack, page tables, the program image, the user stack and its VMAs.
+typedef struct proc {
+  int live;
+  unsigned long pages[PROC_PAGES_MAX];
+  unsigned int sizes[PROC_PAGES_MAX];
+  int page_count;
+  void *vmas[PROC_PAGES_MAX];
+  int vma_count;
+} proc_t;
+
+static proc_t procs[PROC_MAX];
+
+static void proc_spawn(proc_t *p, int is_fork) {
+  int image_pages = is_fork ? 0 : 1 + rng() % 64;
+  int stack_pages = is_fork ? 0 : 16;
+  p->page_count = 0;
+  p->vma_count = 0;
+  p->pages[p->page_count] = page_alloc(PAGE_SIZE); // pgd
+  p->sizes[p->page_count++] = PAGE_SIZE;
+  p->pages[p->page_count] = page_alloc(0x10000); // kernel stack
+  p->sizes[p->page_count++] = 0x10000;
+  for (int i = 0; i < 4; ++i) { // pud, pmd, two ptes
+    p->pages[p->page_count] = page_alloc(PAGE_SIZE);
+    p->sizes[p->page_count++] = PAGE_SIZE;
+  }
+  for (int i = 0; i < image_pages + stack_pages; ++i) {
+    p->pages[p->page_count] = page_alloc(PAGE_SIZE);
+    p->sizes[p->page_count++] = PAGE_SIZE;
+    p->vmas[p->vma_count++] = pool_alloc(64);
+  }
+  p->live = 1;
+}
+
+static void proc_kill(proc_t *p) {
+  for (int i = 0; i < p->vma_count; ++i) {
+    if (p->vmas[i]) {
+      pool_free(p->vmas[i]);
+    }
+  }
+  for (int i = p->page_count - 1; i >= 0; --i) {
+    if (p->pages[i]) {
+      page_free(p->pages[i]);
+    }
+  }
+  p->live = 0;
+}
+
+static void workload_forkexec(long ops) {
+  while ((long)latency_count < ops) {
+    proc_t *p = &procs[rng() % PROC_MAX];
+    if (p->live) {
+      proc_kill(p);
+    } else {
+      proc_spawn(p, rng() % 2);
+    }
+  }
+  for (int i = 0; i < PROC_MAX; ++i) {
+    if (procs[i].live) {
+      proc_kill(&procs[i]);
+    }
+  }
+}
+
+#define CHURN_LIVE_MAX 8192
+
+static void *churn_objects[CHURN_LIVE_MAX];
+
+// Skewed towards the small sizes that vnodes, files and timer tasks use.
+static unsigned int churn_size() {
+  unsigned int shift = 4 + rng() % 7; // 16 .. 1024
+  if (rng() % 2) {
+    shift = 4 + rng() % 3;
+  }
+  unsigned int size = 1U << shift;
+  return size - rng() % (size / 2);
+}
+
+static void workload_churn(long ops, int with_pages) {
+  while ((long)latency_count < ops) {
+    if (with_pages && rng() % 8 == 0) {
+      proc_t *p = &procs[rng() % PROC_MAX];
+      if (p->live) {
+        proc_kill(p);
+      } else {
+        proc_spawn(p, rng() % 2);
+      }
+      continue;
+    }
+    void **slot = &churn_objects[rng() % CHURN_LIVE_MAX];
+    if (*slot) {
+      pool_free(*slot);
+      *slot = NULL;
+    } else {
+      *slot = pool_alloc(churn_size());
+    }
+  }
+  for (int i = 0; i < CHURN_LIVE_MAX; ++i) {
+    if (churn_objects[i]) {
+      pool_free(churn_objects[i]);
+      churn_objects[i] = NULL;
+    }
+  }
+  for (int i = 0; i < PROC_MAX; ++i) {
+    if (procs[i].live) {
+      proc_kill(&procs[i]);
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Trace replay
+
+typedef struct addr_map_entry {
+  unsigned long target;
+  unsigned long host;
+} addr_map_entry_t;
+
+static addr_map_entry_t *addr_map;
+static size_t addr_map_size, addr_map_used;
+
+static size_t addr_map_slot(unsigned long target) {
+  size_t i = (target >> 4) * 0x9E3779B97F4A7C15ULL & (addr_map_size - 1);
+  while (addr_map[i].target && addr_map[i].target != target) {
+    i = (i + 1) & (addr_map_size - 1);
+  }
+  return i;
+}
+
+static void addr_map_put(unsigned long target, unsigned long host) {
+  if ((addr_map_used + 1) * 2 > addr_map_size) {
+    addr_map_entry_t *old = addr_map;
+    size_t old_size = addr_map_size;
+    addr_map_size = old_size ? old_size * 2 : 1 << 16;
+    addr_map = calloc(addr_map_size, sizeof(*addr_map));
+    addr_map_used = 0;
+    for (size_t i = 0; i < old_size; ++i) {
+      if (old[i].target && old[i].host) {
+        addr_map_put(old[i].target, old[i].host);
+      }
+    }
+    free(old);
+  }
+  size_t i = addr_map_slot(target);
+  if (!addr_map[i].target) {
+    addr_map_used++;
+  }
+  addr_map[i].target = target;
+  addr_map[i].host = host;
+}
+
+// Returns and forgets the host address; freed slots keep their key as a
+// tombstone so probe chains stay intact.
+static unsigned long addr_map_take(unsigned long target) {
+  if (!addr_map_size) {
+    return 0;
+  }
+  size_t i = addr_map_slot(target);
+  unsigned long host = addr_map[i].host;
+  addr_map[i].host = 0;
+  return host;
+}
+
+static int workload_replay(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  char line[512], name[64];
+  unsigned long replayed = 0, skipped = 0;
+  while (fgets(line, sizeof(line), f)) {
+    char *rec = strstr(line, "[Trace] ");
+    if (!rec) {
+      continue;
+    }
+    rec += 8;
+    unsigned int size;
+    unsigned long target;
+    uint64_t start;
+    if (sscanf(rec, "P %u %lx", &size, &target) == 2) {
+      addr_map_put(target, page_alloc(size));
+    } else if (sscanf(rec, "p %lx", &target) == 1) {
+      unsigned long host = addr_map_take(target);
+      if (!host) {
+        skipped++;
+        continue;
+      }
+      page_free(host);
+    } else if (sscanf(rec, "S %63s %u %lx", name, &size, &target) == 3) {
+      start = now_ns();
+      void *object = allocbench_cache_alloc(name, size);
+      record(start);
+      addr_map_put(target, (unsigned long)object);
+    } else if (sscanf(rec, "s %63s %lx", name, &target) == 2) {
+      unsigned long host = addr_map_take(target);
+      if (!host) {
+        skipped++;
+        continue;
+      }
+      start = now_ns();
+      allocbench_cache_free((void *)host);
+      record(start);
+    } else {
+      skipped++;
+      continue;
+    }
+    replayed++;
+  }
+  fclose(f);
+  printf("replayed %lu records, skipped %lu\n", replayed, skipped);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(double p) {
+  size_t i = (size_t)(p * (latency_count - 1));
+  return latencies[i];
+}
+
+static void report(uint64_t elapsed_ns) {
+  if (latency_count == 0) {
+    printf("no allocator calls\n");
+    return;
+  }
+  qsort(latencies, latency_count, sizeof(*latencies), cmp_u64);
+  printf("ops          %zu\n", latency_count);
+  printf("elapsed      %.3f s\n", elapsed_ns / 1e9);
+  printf("throughput   %.2f Mops/s\n", latency_count * 1e3 / elapsed_ns);
+  printf("latency ns   p50 %lu  p90 %lu  p99 %lu  p99.9 %lu  max %lu\n",
+         percentile(0.50), percentile(0.90), percentile(0.99),
+         percentile(0.999), latencies[latency_count - 1]);
+  printf("peak fragmentation index by order (0-1000):\n");
+  for (unsigned int i = 0; i <= allocbench_max_order(); ++i) {
+    printf("  order %2u  %4u\n", i, peak_frag[i]);
+  }
+  printf("free pages at exit: %lu\n", allocbench_free_pages());
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-n ops] [-s seed] [-v] forkexec|churn|mixed\n"
+          "       %s [-v] replay <uart log>\n",
+          prog, prog);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  long ops = 1000000;
+  int verbose = 0;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      ops = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      rng_state = strtoull(argv[++i], NULL, 0) | 1;
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = 1;
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (i >= argc) {
+    usage(argv[0]);
+  }
+
+  void *arena = mmap(NULL, allocbench_total_memory(), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (arena == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  allocbench_init((unsigned long)arena, verbose);
+
+  uint64_t start = now_ns();
+  if (strcmp(argv[i], "forkexec") == 0) {
+    workload_forkexec(ops);
+  } else if (strcmp(argv[i], "churn") == 0) {
+    workload_churn(ops, 0);
+  } else if (strcmp(argv[i], "mixed") == 0) {
+    workload_churn(ops, 1);
+  } else if (strcmp(argv[i], "replay") == 0 && i + 1 < argc) {
+    if (workload_replay(argv[i + 1]) != 0) {
+      return 1;
+    }
+  } else {
+    usage(argv[0]);
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  report(elapsed);
+  if (verbose) {
+    allocbench_report();
+  }
+  return 0;
+}
@@ -0,0 +1,170 @@
+// Kernel side of the host build: the globals and platform hooks the
+// allocators expect from global.c, heap.c, uart.c and exception.c, plus a
+// small interface in plain C types for bench.c, which cannot include the
+// kernel headers next to libc.
+#include "../../include/allocator.h"
+#include "../../include/buddy_system.h"
+#include "../../include/heap.h"
+#include "../../include/meminfo.h"
+#include "../../include/shrinker.h"
+#include "../../include/slab.h"
+#include "../../include/types.h"
+#include "../../include/utils.h"
+
+struct host_timespec {
+  long tv_sec;
+  long tv_nsec;
+};
+
+void *calloc(unsigned long nmemb, unsigned long size);
+void free(void *ptr);
+long write(int fd, const void *buf, unsigned long count);
+int clock_gettime(int clk_id, struct host_timespec *tp);
+
+unsigned long allocbench_memory_base;
+static int allocbench_verbose;
+
+// global.c
+buddy_system_node_t buddy_system[MAX_LEVEL + 1];
+uint64_t buddy_system_free_levels = 0;
+uint64_t buddy_system_type_levels[MIGRATE_TYPES];
+uint8_t buddy_system_pageblock_type[PAGEBLOCK_COUNT];
+int (*buddy_system_migrate)(uint64_t from, uint64_t to) = NULL;
+uint64_t buddy_system_free_pages = 0;
+buddy_system_stats_t buddy_system_stats;
+buddy_system_magazine_t buddy_system_magazines[MAGAZINE_LEVELS];
+buddy_system_zero_pool_t buddy_system_zero_pool;
+frame_array_node_t frame_array[TOTAL_MEMORY / PAGE_SIZE];
+kmem_cache_t kmem_caches[KMEM_CACHE_MAX];
+uint32_t kmem_cache_count = 0;
+kmem_cache_t *pools[SMALL_SIZES_COUNT];
+const uint32_t SMALL_SIZES[SMALL_SIZES_COUNT] = {32, 64, 128, 256, 512, 1024};
+kmem_cache_t *large_pools[LARGE_SIZES_COUNT];
+const uint32_t LARGE_SIZES[LARGE_SIZES_COUNT] = {0x800, 0x1000, 0x2000, 0x4000};
+shrinker_t shrinkers[MAX_SHRINKER_REG];
+int shrinking = 0;
+startup_memory_block_t *startup_memory_block_table_start = NULL;
+startup_memory_block_t *startup_memory_block_table_end = NULL;
+int alloc_trace_depth = 0;
+uint64_t vmalloc_pages = 0;
+
+// exception.c: single threaded on the host
+void lock() {}
+void unlock() {}
+
+// uart.c
+void uart_putc(unsigned int c) {
+  char ch = c;
+  if (allocbench_verbose) {
+    write(1, &ch, 1);
+  }
+}
+
+void uart_sendline(const char *fmt, ...) {
+  if (!allocbench_verbose) {
+    return;
+  }
+  char buf[1024];
+  __builtin_va_list args;
+  __builtin_va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, args);
+  __builtin_va_end(args);
+  write(1, buf, strlen(buf));
+}
+
+// timer.h
+unsigned long timer_get_counter() {
+  struct host_timespec ts;
+  clock_gettime(1, &ts); // CLOCK_MONOTONIC
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+unsigned long timer_get_frequency() { return 1000000000UL; }
+
+// heap.c
+void *simple_malloc(unsigned int size, int show_info) {
+  return calloc(1, size);
+}
+
+void simple_memset(void *ptr, int value, unsigned int num) {
+  memset(ptr, value, num);
+}
+
+// memory.S: the kernel's routines are AArch64 assembly
+void *memcpy(void *dest, const void *src, unsigned int n) {
+  return __builtin_memcpy(dest, src, n);
+}
+
+void *memset(void *src, int c, unsigned int n) {
+  return __builtin_memset(src, c, n);
+}
+
+void clear_page(void *page) { __builtin_memset(page, 0, PAGE_SIZE); }
+
+// vmalloc.c: there are no kernel page tables to map into
+void *vmalloc(uint32_t size) { return calloc(1, size); }
+
+void vfree(void *addr) { free(addr); }
+
+unsigned int align_size(unsigned int size, unsigned int alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void allocbench_init(unsigned long base, int verbose) {
+  allocbench_memory_base = base;
+  allocbench_verbose = verbose;
+  buddy_system_init();
+  memory_pool_init();
+}
+
+void allocbench_set_verbose(int verbose) { allocbench_verbose = verbose; }
+
+unsigned long allocbench_page_alloc(unsigned int size) {
+  return buddy_system_allocator(size);
+}
+
+void allocbench_page_free(unsigned long address) {
+  buddy_system_free(address);
+}
+
+void *allocbench_pool_alloc(unsigned int size) {
+  return kmalloc(size, GFP_KERNEL);
+}
+
+void allocbench_pool_free(void *address) { kfree(address); }
+
+// Named caches from a trace are created on first use.
+void *allocbench_cache_alloc(const char *name, unsigned int size) {
+  for (uint32_t i = 0; i < kmem_cache_count; ++i) {
+    if (strcmp(kmem_caches[i].name, name) == 0) {
+      return kmem_cache_alloc(&kmem_caches[i]);
+    }
+  }
+  kmem_cache_t *cache = kmem_cache_create(name, size);
+  return cache ? kmem_cache_alloc(cache) : NULL;
+}
+
+void allocbench_cache_free(void *object) {
+  kmem_cache_t *cache = kmem_cache_of(object);
+  if (cache) {
+    kmem_cache_free(cache, object);
+  }
+}
+
+unsigned long allocbench_free_pages() { return buddy_system_free_pages; }
+
+unsigned int allocbench_max_order() { return MAX_LEVEL; }
+
+unsigned int allocbench_fragmentation(unsigned int order) {
+  return meminfo_fragmentation(order);
+}
+
+unsigned long allocbench_total_memory() { return TOTAL_MEMORY; }
+
+void allocbench_report() {
+  int verbose = allocbench_verbose;
+  allocbench_verbose = 1;
+  meminfo_print();
+  buddy_system_print_stats();
+  allocbench_verbose = verbose;
+}
@@ -0,0 +1,23 @@
+#ifndef ALLOCBENCH_HOST_H
+#define ALLOCBENCH_HOST_H
+
+/*
+ * Forced into every kernel source built for the host. The kernel's string
+ * helpers share names with the C library but not its prototypes, so they
+ * are renamed here; the arena base replaces the linear map.
+ */
+#define memcpy kernel_memcpy
+#define memset kernel_memset
+#define strcmp kernel_strcmp
+#define strncmp kernel_strncmp
+#define strlen kernel_strlen
+#define strcpy kernel_strcpy
+#define strcat kernel_strcat
+#define strchr kernel_strchr
+#define strtok kernel_strtok
+#define atoi kernel_atoi
+#define vsnprintf kernel_vsnprintf
+
+extern unsigned long allocbench_memory_base;
+
+#endif /* ALLOCBENCH_HOST_H */
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Resolve the call sites in an allocprof dump (shell command or
+# /dev/allocprof) against the kernel image built with `make ALLOC_PROFILE=1`.
+#
+#   tools/allocprof.sh dump.txt [build/kernel8.elf]
+#
+# Each address is the return address of the allocator call, so the line
+# looked up is the one of the call instruction just before it.
+ADDR2LINE=${ARMGNU:-aarch64-none-elf}-addr2line
+ELF=${2:-build/kernel8.elf}
+
+while read -r caller bytes live allocs; do
+  case "$caller" in
+  0x*)
+    site=$(printf '0x%x' $((caller - 4)))
+    where=$($ADDR2LINE -f -s -e "$ELF" "$site" | paste -sd ' ')
+    printf '%-12s %8s %8s  %s\n' "$bytes" "$live" "$allocs" "$where"
+    ;;
+  *)
+    printf '%-12s %8s %8s  %s\n' "live_bytes" "live" "allocs" "site"
+    ;;
+  esac
+done < <(tr -d "\r" <"${1:-/dev/stdin}")
@@ -0,0 +1,98 @@
+// Rewrite a newc cpio archive so the data of every file of a page or more
+// starts on a page boundary, letting the kernel map those pages in place.
+//
+//   cpioalign < in.cpio > out.cpio
+//
+// The archive is loaded at a page-aligned address (config.txt), so an
+// offset in the archive is aligned exactly when the address is. The padding
+// goes into the file's own name field: c_namesize grows and the name is
+// followed by extra NULs. Every reader takes the name up to its first NUL
+// and finds the data c_namesize bytes on, so the entries and their names
+// are unchanged; only c_namesize differs from what cpio writes.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_SIZE 4096
+#define HEADER_SIZE 110
+#define ALIGN4(x) (((x) + 3) & ~3UL)
+
+static unsigned long field(const char *hdr, int idx) {
+  char buf[9];
+  memcpy(buf, hdr + 6 + idx * 8, 8);
+  buf[8] = 0;
+  return strtoul(buf, NULL, 16);
+}
+
+static void put(const void *buf, size_t len) {
+  if (fwrite(buf, 1, len, stdout) != len) {
+    perror("cpioalign");
+    exit(1);
+  }
+}
+
+static void put_zero(unsigned long len) {
+  static const char zero[PAGE_SIZE];
+  while (len) {
+    unsigned long n = len < PAGE_SIZE ? len : PAGE_SIZE;
+    put(zero, n);
+    len -= n;
+  }
+}
+
+int main() {
+  size_t cap = 1 << 20, len = 0, n;
+  char *in = malloc(cap);
+  while (in && (n = fread(in + len, 1, cap - len, stdin)) > 0) {
+    len += n;
+    if (len == cap) {
+      in = realloc(in, cap *= 2);
+    }
+  }
+  if (!in) {
+    perror("cpioalign");
+    return 1;
+  }
+
+  unsigned long pos = 0, out = 0;
+  while (pos + HEADER_SIZE <= len) {
+    const char *hdr = in + pos;
+    if (memcmp(hdr, "070701", 6) != 0) {
+      fprintf(stderr, "cpioalign: bad magic at offset %lu\n", pos);
+      return 1;
+    }
+    unsigned long mode = field(hdr, 1);
+    unsigned long filesize = field(hdr, 6);
+    unsigned long namesize = field(hdr, 11);
+    unsigned long entry = ALIGN4(HEADER_SIZE + namesize) + ALIGN4(filesize);
+    if (pos + entry > len) {
+      fprintf(stderr, "cpioalign: truncated entry at offset %lu\n", pos);
+      return 1;
+    }
+    unsigned long padded = namesize;
+    if ((mode & 0170000) == 0100000 && filesize >= PAGE_SIZE) {
+      // smallest name field that ends on a page boundary
+      padded = (PAGE_SIZE - (out + HEADER_SIZE) % PAGE_SIZE) % PAGE_SIZE;
+      while (padded < namesize) {
+        padded += PAGE_SIZE;
+      }
+    }
+    char field[9];
+    snprintf(field, sizeof(field), "%08lX", padded);
+    put(hdr, HEADER_SIZE - 16);
+    put(field, 8);
+    put(hdr + HEADER_SIZE - 8, 8);
+    put(hdr + HEADER_SIZE, namesize);
+    unsigned long head = ALIGN4(HEADER_SIZE + padded);
+    put_zero(head - HEADER_SIZE - namesize);
+    put(hdr + ALIGN4(HEADER_SIZE + namesize), ALIGN4(filesize));
+    out += head + ALIGN4(filesize);
+    pos += entry;
+    if (strcmp(hdr + HEADER_SIZE, "TRAILER!!!") == 0) {
+      break;
+    }
+  }
+  // keep the archive a multiple of 512 bytes, as cpio writes it
+  put_zero((512 - out % 512) % 512);
+  return 0;
+}
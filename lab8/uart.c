@@ -1,6 +1,7 @@
 #include "include/uart.h"
 #include "include/exception.h"
 #include "include/irq.h"
+#include "include/log.h"
 #include "include/thread.h"
 #include "include/utils.h"
 
@@ -147,7 +148,10 @@ void uart_tx_handler(char *arg) {
     *AUX_MU_IO = tx_buffer.buffer[tx_buffer.tail];
     tx_buffer.tail = (tx_buffer.tail + 1) % BUFFER_SIZE;
   }
-  if (tx_buffer.head == tx_buffer.tail) {
-    *AUX_MU_IER &= ~0x02;
+  // Then the kernel log; klog re-arms the interrupt for lines published
+  // after this point.
+  *AUX_MU_IER &= ~0x02;
+  if (log_console_drain()) {
+    *AUX_MU_IER |= 0x02;
   }
 }
\ No newline at end of file
@@ -241,20 +241,3 @@ void delay(int count) {
     asm volatile("nop");
   }
 }
-
-void *memcpy(void *dest, const void *src, unsigned int n) {
-  unsigned char *d = (unsigned char *)dest;
-  const unsigned char *s = (const unsigned char *)src;
-  while (n--) {
-    *d++ = *s++;
-  }
-  return dest;
-}
-
-void *memset(void *src, int c, unsigned int n) {
-  unsigned char *p = src;
-  while (n--) {
-    *p++ = (unsigned char)c;
-  }
-  return src;
-}
\ No newline at end of file
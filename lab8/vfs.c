@@ -1,10 +1,15 @@
 #include "include/vfs.h"
 #include "include/allocator.h"
+#include "include/dev_allocprof.h"
 #include "include/dev_framebuffer.h"
+#include "include/dev_meminfo.h"
 #include "include/dev_uart.h"
 #include "include/fat32.h"
 #include "include/initramfs.h"
+#include "include/log.h"
+#include "include/pagecache.h"
 #include "include/sdhost.h"
+#include "include/slab.h"
 #include "include/tmpfs.h"
 #include "include/types.h"
 #include "include/uart.h"
@@ -13,6 +18,8 @@
 extern mount_t *rootfs;
 extern filesystem_t reg_fs[MAX_FS_REG];
 extern file_operations_t reg_dev[MAX_DEV_REG];
+extern kmem_cache_t *vnode_cache;
+extern kmem_cache_t *file_cache;
 
 int register_filesystem(filesystem_t *fs) {
   for (int i = 0; i < MAX_FS_REG; ++i) {
@@ -46,7 +53,13 @@ filesystem_t *find_filesystem(const char *fs_name) {
 }
 
 int vfs_write(file_t *file, const void *buf, size_t len) {
-  return file->f_ops->write(file, buf, len);
+  size_t pos = file->f_pos;
+  int ret = file->f_ops->write(file, buf, len);
+  // pages of the file mapped into processes see the write too
+  if (ret > 0 && file->vnode->page_cache) {
+    page_cache_write(file->vnode, pos, buf, ret);
+  }
+  return ret;
 }
 
 int vfs_read(file_t *file, void *buf, size_t len) {
@@ -68,16 +81,22 @@ int vfs_open(const char *pathname, int flags, file_t **target) {
     if (vfs_lookup(dirname, &node) != 0) {
       return -1;
     }
-    uart_sendline("[vfs_open] Create file...\n");
+    log_debug("[vfs_open] Create file...\n");
     if (node->v_ops->create(node, &node, pathname + last_slash_idx + 1) != 0) {
       return -1;
     }
-    *target = memory_pool_allocator(sizeof(file_t), 0);
+    *target = kmem_cache_alloc(file_cache);
+    if (!*target) {
+      return -1;
+    }
     node->f_ops->open(node, target);
     (*target)->flags = flags;
     return 0;
   } else {
-    *target = memory_pool_allocator(sizeof(file_t), 0);
+    *target = kmem_cache_alloc(file_cache);
+    if (!*target) {
+      return -1;
+    }
     node->f_ops->open(node, target);
     (*target)->flags = flags;
     return 0;
@@ -191,7 +210,7 @@ int vfs_mount(const char *target, const char *filesystem) {
   if (vfs_lookup(target, &dirnode) == -1) {
     return -1;
   } else {
-    dirnode->mount = memory_pool_allocator(sizeof(mount_t), 0);
+    dirnode->mount = kmalloc(sizeof(mount_t), GFP_KERNEL);
     fs->setup_mount(fs, dirnode->mount);
   }
   return 0;
@@ -199,7 +218,7 @@ int vfs_mount(const char *target, const char *filesystem) {
 
 // Virtual File System Make Node
 int vfs_mknod(char *pathname, int id) {
-  file_t *f = memory_pool_allocator(sizeof(file_t), 0);
+  file_t *f;
   vfs_open(pathname, O_CREAT, &f);
   f->vnode->f_ops = &reg_dev[id];
   vfs_close(f);
@@ -207,8 +226,11 @@ int vfs_mknod(char *pathname, int id) {
 }
 
 void init_rootfs() {
+  vnode_cache = kmem_cache_create("vnode", sizeof(vnode_t));
+  file_cache = kmem_cache_create("file", sizeof(file_t));
+  page_cache_init();
   int idx = register_tmpfs();
-  rootfs = memory_pool_allocator(sizeof(mount_t), 0);
+  rootfs = kmalloc(sizeof(mount_t), GFP_KERNEL);
   reg_fs[idx].setup_mount(&reg_fs[idx], rootfs);
 
   vfs_mkdir("/initramfs");
@@ -222,6 +244,12 @@ void init_rootfs() {
   int framebuffer_id = init_dev_framebuffer();
   vfs_mknod("/dev/framebuffer", framebuffer_id);
 
+  int meminfo_id = init_dev_meminfo();
+  vfs_mknod("/dev/meminfo", meminfo_id);
+
+  int allocprof_id = init_dev_allocprof();
+  vfs_mknod("/dev/allocprof", allocprof_id);
+
   vfs_mkdir("/home");
   vfs_mkdir("/home/user");
   vfs_mkdir("/home/user/docs");
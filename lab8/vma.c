@@ -0,0 +1,164 @@
+#include "include/vma.h"
+#include "include/types.h"
+
+static inline int vma_height(vm_area_struct_t *n) { return n ? n->height : 0; }
+
+static inline uint64_t vma_max(uint64_t a, uint64_t b) { return a > b ? a : b; }
+
+static inline uint64_t vma_end(vm_area_struct_t *n) {
+  return n->virt_addr + n->area_size;
+}
+
+// Recompute n's height and subtree summary from its children.
+static void vma_tree_update(vm_area_struct_t *n) {
+  vm_area_struct_t *l = n->left, *r = n->right;
+  n->height = 1 + (vma_height(l) > vma_height(r) ? vma_height(l)
+                                                  : vma_height(r));
+  n->subtree_start = l ? l->subtree_start : n->virt_addr;
+  n->subtree_end = r ? r->subtree_end : vma_end(n);
+  n->subtree_gap = 0;
+  if (l) {
+    n->subtree_gap = vma_max(l->subtree_gap, n->virt_addr - l->subtree_end);
+  }
+  if (r) {
+    n->subtree_gap = vma_max(n->subtree_gap, r->subtree_gap);
+    n->subtree_gap = vma_max(n->subtree_gap, r->subtree_start - vma_end(n));
+  }
+}
+
+static vm_area_struct_t *vma_rotate_right(vm_area_struct_t *n) {
+  vm_area_struct_t *l = n->left;
+  n->left = l->right;
+  l->right = n;
+  vma_tree_update(n);
+  vma_tree_update(l);
+  return l;
+}
+
+static vm_area_struct_t *vma_rotate_left(vm_area_struct_t *n) {
+  vm_area_struct_t *r = n->right;
+  n->right = r->left;
+  r->left = n;
+  vma_tree_update(n);
+  vma_tree_update(r);
+  return r;
+}
+
+static vm_area_struct_t *vma_balance(vm_area_struct_t *n) {
+  vma_tree_update(n);
+  int factor = vma_height(n->left) - vma_height(n->right);
+  if (factor > 1) {
+    if (vma_height(n->left->left) < vma_height(n->left->right)) {
+      n->left = vma_rotate_left(n->left);
+    }
+    return vma_rotate_right(n);
+  }
+  if (factor < -1) {
+    if (vma_height(n->right->right) < vma_height(n->right->left)) {
+      n->right = vma_rotate_right(n->right);
+    }
+    return vma_rotate_left(n);
+  }
+  return n;
+}
+
+static vm_area_struct_t *vma_insert(vm_area_struct_t *n,
+                                    vm_area_struct_t *vma) {
+  if (!n) {
+    return vma;
+  }
+  if (vma->virt_addr < n->virt_addr) {
+    n->left = vma_insert(n->left, vma);
+  } else {
+    n->right = vma_insert(n->right, vma);
+  }
+  return vma_balance(n);
+}
+
+void vma_tree_insert(vm_area_struct_t **root, vm_area_struct_t *vma) {
+  vma->left = vma->right = NULL;
+  vma_tree_update(vma);
+  *root = vma_insert(*root, vma);
+}
+
+// Unlink the leftmost node of n into *min.
+static vm_area_struct_t *vma_remove_min(vm_area_struct_t *n,
+                                        vm_area_struct_t **min) {
+  if (!n->left) {
+    *min = n;
+    return n->right;
+  }
+  n->left = vma_remove_min(n->left, min);
+  return vma_balance(n);
+}
+
+static vm_area_struct_t *vma_remove(vm_area_struct_t *n,
+                                    vm_area_struct_t *vma) {
+  if (!n) {
+    return NULL;
+  }
+  if (n == vma) {
+    if (!n->left || !n->right) {
+      return n->left ? n->left : n->right;
+    }
+    vm_area_struct_t *min;
+    vm_area_struct_t *right = vma_remove_min(n->right, &min);
+    min->left = n->left;
+    min->right = right;
+    return vma_balance(min);
+  }
+  if (vma->virt_addr < n->virt_addr) {
+    n->left = vma_remove(n->left, vma);
+  } else {
+    n->right = vma_remove(n->right, vma);
+  }
+  return vma_balance(n);
+}
+
+void vma_tree_remove(vm_area_struct_t **root, vm_area_struct_t *vma) {
+  *root = vma_remove(*root, vma);
+}
+
+// The area holding addr, or NULL.
+vm_area_struct_t *vma_tree_find(vm_area_struct_t *root, uint64_t addr) {
+  while (root) {
+    if (addr < root->virt_addr) {
+      root = root->left;
+    } else if (addr >= vma_end(root)) {
+      root = root->right;
+    } else {
+      return root;
+    }
+  }
+  return NULL;
+}
+
+// Lowest align-aligned address at or above hint where len bytes fit in the
+// free range [lo, hi) left around subtree n. Subtrees whose widest hole is
+// too small, or which end before hint, are skipped whole.
+static uint64_t vma_gap_search(vm_area_struct_t *n, uint64_t lo, uint64_t hi,
+                               uint64_t hint, uint64_t len, uint64_t align) {
+  if (hi <= lo || hi <= hint || hi - hint < len) {
+    return VMA_NO_GAP;
+  }
+  if (!n) {
+    uint64_t addr = (vma_max(lo, hint) + align - 1) & ~(align - 1);
+    return addr < hi && hi - addr >= len ? addr : VMA_NO_GAP;
+  }
+  uint64_t widest = vma_max(n->subtree_gap, n->subtree_start - lo);
+  if (vma_max(widest, hi - n->subtree_end) < len) {
+    return VMA_NO_GAP;
+  }
+  uint64_t addr = vma_gap_search(n->left, lo, n->virt_addr, hint, len, align);
+  if (addr != VMA_NO_GAP) {
+    return addr;
+  }
+  return vma_gap_search(n->right, vma_end(n), hi, hint, len, align);
+}
+
+// Lowest align-aligned address at or above hint where [addr, addr + len)
+// overlaps no area and ends by limit, or VMA_NO_GAP.
+uint64_t vma_tree_find_gap(vm_area_struct_t *root, uint64_t hint,
+                           uint64_t len, uint64_t align, uint64_t limit) {
+  return vma_gap_search(root, 0, limit, hint, len, align);
+}
@@ -0,0 +1,143 @@
+#include "include/vmalloc.h"
+#include "include/alloc_profile.h"
+#include "include/allocator.h"
+#include "include/buddy_system.h"
+#include "include/dlist.h"
+#include "include/exception.h"
+#include "include/mmu.h"
+#include "include/slab.h"
+#include "include/types.h"
+#include "include/uart.h"
+
+extern double_linked_node_t vmap_area_list;
+extern kmem_cache_t *vmap_area_cache;
+extern uint64_t vmalloc_pages;
+
+static inline size_t *vmalloc_pgd() {
+  return (size_t *)PHYS_TO_VIRT(MMU_PGD_ADDR);
+}
+
+void vmalloc_init() {
+  double_linked_init(&vmap_area_list);
+  vmap_area_cache = kmem_cache_create("vmap_area", sizeof(vmap_area_t));
+}
+
+// First fit over the gaps between the sorted areas.
+static vmap_area_t *vmalloc_reserve(uint64_t size) {
+  uint64_t start = VMALLOC_START;
+  double_linked_node_t *cur;
+  double_linked_for_each(cur, &vmap_area_list) {
+    vmap_area_t *area = (vmap_area_t *)cur;
+    if (start + size <= area->start) {
+      break;
+    }
+    start = area->start + area->size;
+  }
+  if (start + size > VMALLOC_END) {
+    return NULL;
+  }
+  vmap_area_t *area = kmem_cache_alloc(vmap_area_cache);
+  if (!area) {
+    return NULL;
+  }
+  area->start = start;
+  area->size = size;
+  double_linked_add_before((double_linked_node_t *)area, cur);
+  return area;
+}
+
+// Clear the mapped pages of an area and give them back to the buddy system.
+static void vmalloc_unmap(vmap_area_t *area) {
+  uint64_t batch[VMALLOC_BATCH];
+  uint32_t batch_count = 0;
+  for (uint64_t va = area->start + PAGE_SIZE; va < area->start + area->size;
+       va += PAGE_SIZE) {
+    size_t *pte = mmu_find_pte(vmalloc_pgd(), va);
+    if (!pte || !*pte) {
+      continue;
+    }
+    batch[batch_count++] = PHYS_TO_VIRT((*pte & ENTRY_ADDR_MASK));
+    *pte = 0;
+    asm volatile("dsb ishst\n"
+                 "tlbi vaae1is, %0\n" ::"r"(va >> PAGE_SHIFT));
+    if (batch_count == VMALLOC_BATCH) {
+      asm volatile("dsb ish\n");
+      free_pages_bulk(batch_count, batch);
+      batch_count = 0;
+    }
+  }
+  asm volatile("dsb ish\n"
+               "isb\n");
+  if (batch_count) {
+    free_pages_bulk(batch_count, batch);
+  }
+  vmalloc_pages -= area->size / PAGE_SIZE - 1;
+}
+
+// Virtually contiguous memory built from single pages, for kernel stacks and
+// buffers that would otherwise need a high-order buddy block.
+void *vmalloc(uint32_t size) {
+  if (size == 0) {
+    return NULL;
+  }
+  uint32_t nr_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+  lock();
+  vmap_area_t *area = vmalloc_reserve((uint64_t)(nr_pages + 1) * PAGE_SIZE);
+  if (!area) {
+    uart_sendline("[vmalloc Error] No virtual space for %u bytes.\n", size);
+    unlock();
+    return NULL;
+  }
+  vmalloc_pages += nr_pages;
+
+  uint64_t pages[VMALLOC_BATCH];
+  uint64_t va = area->start + PAGE_SIZE;
+  while (nr_pages > 0) {
+    uint32_t n = nr_pages < VMALLOC_BATCH ? nr_pages : VMALLOC_BATCH;
+    alloc_profile_enter();
+    uint32_t got = alloc_pages_bulk(n, pages, GFP_KERNEL);
+    alloc_profile_exit();
+    if (!got) {
+      goto fail;
+    }
+    for (uint32_t i = 0; i < n; ++i, va += PAGE_SIZE) {
+      alloc_profile_tag((void *)pages[i], PAGE_SIZE, alloc_profile_caller());
+      if (map_one_page(vmalloc_pgd(), va, VIRT_TO_PHYS(pages[i]), PD_UNX)) {
+        free_pages_bulk(n - i, pages + i);
+        goto fail;
+      }
+    }
+    nr_pages -= n;
+  }
+  asm volatile("dsb ishst\n"
+               "isb\n");
+  unlock();
+  return (void *)(area->start + PAGE_SIZE);
+
+fail:
+  vmalloc_unmap(area);
+  double_linked_remove((double_linked_node_t *)area);
+  kmem_cache_free(vmap_area_cache, area);
+  unlock();
+  return NULL;
+}
+
+void vfree(void *addr) {
+  if (!addr) {
+    return;
+  }
+  lock();
+  double_linked_node_t *cur;
+  double_linked_for_each(cur, &vmap_area_list) {
+    vmap_area_t *area = (vmap_area_t *)cur;
+    if (area->start + PAGE_SIZE == (uint64_t)addr) {
+      vmalloc_unmap(area);
+      double_linked_remove(cur);
+      kmem_cache_free(vmap_area_cache, area);
+      unlock();
+      return;
+    }
+  }
+  uart_sendline("[vmalloc Error] Bad vfree of 0x%p.\n", addr);
+  unlock();
+}